@@ -0,0 +1,37 @@
+#ifndef _ADAPTIVE_CHUNK_H
+#define _ADAPTIVE_CHUNK_H
+
+#include <algorithm>
+
+/*
+ * Guided chunk sizing for pools that hand out task indices from a shared
+ * counter. A worker claims 1 / (2 * workers) of the indices that are left, so
+ * chunks are large while plenty of work remains and shrink toward a single
+ * index near the tail. Each chunk is further capped so that it runs for about
+ * targetSeconds() given the measured cost of one task; a launch whose cost
+ * has not been measured yet is handed out one index at a time.
+ */
+class AdaptiveChunk {
+  public:
+    static double targetSeconds() {
+        return 20e-6;
+    }
+
+    // Number of indices to claim when `remaining` are left to hand out.
+    static int size(int remaining, int numWorkers, double secondsPerTask) {
+        if (remaining <= 1 || secondsPerTask <= 0.0) {
+            return 1;
+        }
+        int guided = remaining / (2 * numWorkers);
+        double byTime = targetSeconds() / secondsPerTask;
+        int chunk = byTime < guided ? static_cast<int>(byTime) : guided;
+        return std::max(1, std::min(chunk, remaining));
+    }
+
+    // Folds the per-task cost measured over one chunk into the running estimate.
+    static double update(double estimate, double sample) {
+        return estimate <= 0.0 ? sample : 0.75 * estimate + 0.25 * sample;
+    }
+};
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef _CACHE_LINE_H
+#define _CACHE_LINE_H
+
+/*
+ * Unit of coherence traffic. State written by different threads is kept on
+ * separate lines with alignas(CACHE_LINE_SIZE), so a write by one thread
+ * does not invalidate what the others are reading. Build with a smaller
+ * value (make CACHE_LINE_SIZE=8) to pack that state together again, e.g. to
+ * measure what the padding buys (see make padding_bench).
+ */
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+#endif
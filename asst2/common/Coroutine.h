@@ -0,0 +1,122 @@
+#ifndef _COROUTINE_H
+#define _COROUTINE_H
+
+#include "itasksys.h"
+#include <coroutine>
+#include <exception>
+#include <utility>
+#include <vector>
+
+/*
+ * C++20 coroutine front end to ITaskSystem::runAsyncWithDeps(), for host
+ * code that orchestrates launches without blocking a thread in sync():
+ *
+ *   LaunchCoroutine pipeline(ITaskSystem& t, ...) {
+ *       TaskID a = co_await launch(t, &first, n);
+ *       co_await launch(t, &second, n, {a, other});
+ *   }
+ *
+ *   LaunchCoroutine p = pipeline(t, ...);
+ *   ...
+ *   t.sync();
+ *
+ * co_await launch() submits the launch, then a one-task continuation launch
+ * that depends on it and resumes the coroutine, and suspends. The coroutine
+ * carries on inside the continuation's task, on whichever thread runs it: a
+ * pool worker, or a thread helping out in sync(). Since every step submits
+ * the next one before its continuation finishes, sync() on the task system
+ * returns only once the coroutine has run to the end. It evaluates to the
+ * TaskID of the launch, which later launches may list in their deps.
+ *
+ * The coroutine starts right away on the calling thread and runs there up
+ * to its first co_await. Its frame lives until the LaunchCoroutine is
+ * destroyed, which must not happen before the task system has been synced.
+ * The coroutine itself must not call sync(); it co_awaits instead.
+ */
+class LaunchCoroutine {
+  public:
+    struct promise_type {
+        // Runnable of the continuation launches: resumes this coroutine.
+        // Only one is ever pending, since the coroutine waits on one
+        // launch at a time.
+        class Resume: public IRunnable {
+            public:
+                std::coroutine_handle<promise_type> handle;
+                void runTask(int task_id, int num_total_tasks) {
+                    handle.resume();
+                }
+        } resume;
+
+        LaunchCoroutine get_return_object() {
+            return LaunchCoroutine(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_never initial_suspend() noexcept {
+            return {};
+        }
+        std::suspend_always final_suspend() noexcept {
+            return {};
+        }
+        void return_void() {}
+        void unhandled_exception() {
+            std::terminate();
+        }
+    };
+
+    explicit LaunchCoroutine(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+    LaunchCoroutine(LaunchCoroutine&& other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+    LaunchCoroutine(const LaunchCoroutine&) = delete;
+    LaunchCoroutine& operator=(const LaunchCoroutine&) = delete;
+    ~LaunchCoroutine() {
+        if (handle_) {
+            handle_.destroy();
+        }
+    }
+
+    // Whether the coroutine has run to the end. Only meaningful once the
+    // task system has been synced, or from the coroutine's own thread.
+    bool done() const {
+        return handle_.done();
+    }
+
+  private:
+    std::coroutine_handle<promise_type> handle_;
+};
+
+// What co_await launch(...) waits on
+class LaunchAwaiter {
+    ITaskSystem& t_;
+    IRunnable* runnable_;
+    int num_total_tasks_;
+    const std::vector<TaskID>& deps_;
+    TaskID id_;
+
+  public:
+    LaunchAwaiter(ITaskSystem& t, IRunnable* runnable, int num_total_tasks, const std::vector<TaskID>& deps)
+        : t_(t), runnable_(runnable), num_total_tasks_(num_total_tasks), deps_(deps), id_(-1) {}
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    void await_suspend(std::coroutine_handle<LaunchCoroutine::promise_type> handle) {
+        id_ = t_.runAsyncWithDeps(runnable_, num_total_tasks_, deps_);
+        LaunchCoroutine::promise_type::Resume& resume = handle.promise().resume;
+        resume.handle = handle;
+        std::vector<TaskID> after(1, id_);
+        t_.runAsyncWithDeps(&resume, 1, after);
+        // The coroutine may be running again on another thread by now, so
+        // nothing in its frame (this awaiter included) is touched from here
+    }
+
+    TaskID await_resume() const noexcept {
+        return id_;
+    }
+};
+
+// deps is only read while the co_await submits the launch
+inline LaunchAwaiter launch(ITaskSystem& t, IRunnable* runnable, int num_total_tasks,
+                            const std::vector<TaskID>& deps = std::vector<TaskID>()) {
+    return LaunchAwaiter(t, runnable, num_total_tasks, deps);
+}
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef _PARALLEL_FOR_H
+#define _PARALLEL_FOR_H
+
+#include "itasksys.h"
+#include <algorithm>
+#include <type_traits>
+
+/*
+ * Template front end to ITaskSystem::run() for loops written as lambdas or
+ * functors. The index space [0, n) is cut into contiguous blocks of `grain`
+ * indices, one task per block, and the body is called directly inside the
+ * block. That costs one virtual runTask() per block instead of one per index,
+ * and since the body is inlined into the block loop the compiler can
+ * vectorize across it.
+ *
+ *   parallel_for(t, n, [&](int i) { out[i] = in[i] * 2; });
+ *   parallel_for_range(t, n, [&](int begin, int end) { ... });
+ *
+ * Both return once every index has run. A grain of 0 picks one with
+ * ParallelFor::defaultGrain().
+ */
+class ParallelFor {
+  public:
+    // Blocks per launch with the default grain: plenty for the pool to
+    // balance load, few enough that each block amortizes its runTask() call.
+    static int maxBlocks() {
+        return 256;
+    }
+
+    static int defaultGrain(int n) {
+        return std::max(1, n / maxBlocks());
+    }
+};
+
+// IRunnable adapter: task i runs the body over block i
+template <typename Body>
+class RangeRunnable: public IRunnable {
+    public:
+        Body& body_;
+        int n_;
+        int grain_;
+        RangeRunnable(Body& body, int n, int grain) : body_(body), n_(n), grain_(grain) {}
+        ~RangeRunnable() {}
+
+        void runTask(int task_id, int num_total_tasks) {
+            int begin = task_id * grain_;
+            body_(begin, begin + std::min(grain_, n_ - begin));
+        }
+};
+
+template <typename F>
+void parallel_for_range(ITaskSystem& t, int n, F&& body, int grain = 0) {
+    if (n <= 0) {
+        return;
+    }
+    if (grain <= 0) {
+        grain = ParallelFor::defaultGrain(n);
+    }
+    int blocks = n / grain + (n % grain != 0);
+    if (blocks == 1) {
+        body(0, n); // not worth a launch
+        return;
+    }
+    RangeRunnable<typename std::remove_reference<F>::type> runnable(body, n, grain);
+    t.run(&runnable, blocks);
+}
+
+template <typename F>
+void parallel_for(ITaskSystem& t, int n, F&& body, int grain = 0) {
+    parallel_for_range(t, n, [&body](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            body(i);
+        }
+    }, grain);
+}
+
+#endif
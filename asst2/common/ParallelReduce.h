@@ -0,0 +1,103 @@
+#ifndef _PARALLEL_REDUCE_H
+#define _PARALLEL_REDUCE_H
+
+#include "itasksys.h"
+#include "CacheLine.h"
+#include "ParallelFor.h"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+/*
+ * Reduction over [0, n) on top of ITaskSystem::run(), in the style of
+ * parallel_for_range():
+ *
+ *   double sum = parallel_reduce(t, n, 0.0,
+ *       [&](int begin, int end, double& acc) { for (...) acc += x[i]; },
+ *       [](double& into, const double& from) { into += from; });
+ *
+ * Each block of `grain` indices accumulates into its own partial, a copy of
+ * identity on its own cache line. Partials are then combined pairwise up a
+ * binary tree over the blocks: whichever of two sibling blocks finishes last
+ * combines the right subtree into the left one and carries on upwards, so
+ * the combine runs inside the same launch and in parallel across subtrees.
+ * The tree has a fixed shape, so for a given n and grain the result does not
+ * depend on which thread ran what, floating point included.
+ *
+ * identity must be neutral for combine. A grain of 0 picks one with
+ * ParallelFor::defaultGrain().
+ */
+
+// One partial result, on its own cache line(s)
+template <typename T>
+struct alignas(CACHE_LINE_SIZE) ReducePartial {
+    T value;
+    explicit ReducePartial(const T& identity) : value(identity) {}
+};
+
+// IRunnable adapter: task i reduces block i, then combines up the tree
+template <typename T, typename Body, typename Combine>
+class ReduceRunnable: public IRunnable {
+    public:
+        Body& body_;
+        Combine& combine_;
+        int n_;
+        int grain_;
+        int blocks_;
+        std::vector<ReducePartial<T>> partials_;
+
+        // One counter per inner node of the tree, indexed by the first block
+        // of the node's right child, which is unique across levels
+        std::unique_ptr<std::atomic<int>[]> arrivals_;
+
+        ReduceRunnable(Body& body, Combine& combine, const T& identity, int n, int grain, int blocks)
+            : body_(body), combine_(combine), n_(n), grain_(grain), blocks_(blocks),
+              partials_(blocks, ReducePartial<T>(identity)), arrivals_(new std::atomic<int>[blocks]) {
+            for (int i = 0; i < blocks; ++i) {
+                arrivals_[i].store(0, std::memory_order_relaxed);
+            }
+        }
+        ~ReduceRunnable() {}
+
+        void runTask(int task_id, int num_total_tasks) {
+            int begin = task_id * grain_;
+            body_(begin, begin + std::min(grain_, n_ - begin), partials_[task_id].value);
+
+            // Walk up while this block's subtree is the last one to finish
+            for (int width = 1; width < blocks_; width *= 2) {
+                int left = task_id & ~(2 * width - 1);
+                int right = left + width;
+                if (right >= blocks_) {
+                    continue; // no right subtree at this level
+                }
+                if (arrivals_[right].fetch_add(1, std::memory_order_acq_rel) == 0) {
+                    return; // the sibling subtree is still running, it combines
+                }
+                combine_(partials_[left].value, partials_[right].value);
+            }
+        }
+};
+
+template <typename T, typename Body, typename Combine>
+T parallel_reduce(ITaskSystem& t, int n, const T& identity, Body&& body, Combine&& combine, int grain = 0) {
+    if (n <= 0) {
+        return identity;
+    }
+    if (grain <= 0) {
+        grain = ParallelFor::defaultGrain(n);
+    }
+    int blocks = n / grain + (n % grain != 0);
+    if (blocks == 1) {
+        T result(identity);
+        body(0, n, result);
+        return result;
+    }
+    ReduceRunnable<T, typename std::remove_reference<Body>::type, typename std::remove_reference<Combine>::type>
+        runnable(body, combine, identity, n, grain, blocks);
+    t.run(&runnable, blocks);
+    return runnable.partials_[0].value;
+}
+
+#endif
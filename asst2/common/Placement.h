@@ -0,0 +1,287 @@
+#ifndef _PLACEMENT_H
+#define _PLACEMENT_H
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+/*
+ * One logical CPU and where it sits: its socket (package), its core complex
+ * (the CPUs sharing a last-level cache, named by the lowest of them) and its
+ * physical core.
+ */
+struct CpuInfo {
+    int cpu;
+    int package;
+    int complex;
+    int core;
+};
+
+/*
+ * Reads the CPU topology from /sys. Only CPUs this process is allowed to run
+ * on are returned, ordered so that CPUs sharing a package, complex and core
+ * are next to each other. Without /sys every CPU is its own core in one
+ * package.
+ */
+class CpuTopology {
+  public:
+    // Parses a kernel CPU list such as "0-3,8,10-11".
+    static std::vector<int> parseCpuList(const std::string& list) {
+        std::vector<int> cpus;
+        size_t pos = 0;
+        while (pos < list.size()) {
+            size_t comma = list.find(',', pos);
+            if (comma == std::string::npos) {
+                comma = list.size();
+            }
+            std::string item = list.substr(pos, comma - pos);
+            size_t dash = item.find('-');
+            if (!item.empty() && item[0] >= '0' && item[0] <= '9') {
+                int first = atoi(item.c_str());
+                int last = dash == std::string::npos ? first : atoi(item.c_str() + dash + 1);
+                for (int cpu = first; cpu <= last; ++cpu) {
+                    cpus.push_back(cpu);
+                }
+            }
+            pos = comma + 1;
+        }
+        return cpus;
+    }
+
+    static std::vector<CpuInfo> load() {
+        std::vector<CpuInfo> topology;
+        for (int cpu : allowedCpus()) {
+            std::string dir = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+            CpuInfo info;
+            info.cpu = cpu;
+            info.package = readInt(dir + "/topology/physical_package_id", 0);
+            info.core = readInt(dir + "/topology/core_id", cpu);
+            std::vector<int> llc = parseCpuList(readLine(lastLevelCache(dir) + "/shared_cpu_list"));
+            info.complex = llc.empty() ? info.package : llc[0];
+            topology.push_back(info);
+        }
+        std::sort(topology.begin(), topology.end(), [](const CpuInfo& a, const CpuInfo& b) {
+            return std::make_tuple(a.package, a.complex, a.core, a.cpu) <
+                   std::make_tuple(b.package, b.complex, b.core, b.cpu);
+        });
+        return topology;
+    }
+
+  private:
+    static std::vector<int> allowedCpus() {
+        std::vector<int> cpus;
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+            for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+                if (CPU_ISSET(cpu, &set)) {
+                    cpus.push_back(cpu);
+                }
+            }
+        }
+#endif
+        if (cpus.empty()) {
+            int n = std::max(1u, std::thread::hardware_concurrency());
+            for (int cpu = 0; cpu < n; ++cpu) {
+                cpus.push_back(cpu);
+            }
+        }
+        return cpus;
+    }
+
+    // The cache index with the highest level, e.g. ".../cache/index3".
+    static std::string lastLevelCache(const std::string& cpuDir) {
+        std::string best;
+        int bestLevel = 0;
+        for (int index = 0; index < 8; ++index) {
+            std::string dir = cpuDir + "/cache/index" + std::to_string(index);
+            int level = readInt(dir + "/level", 0);
+            if (level > bestLevel) {
+                bestLevel = level;
+                best = dir;
+            }
+        }
+        return best;
+    }
+
+    static std::string readLine(const std::string& path) {
+        std::ifstream file(path);
+        std::string line;
+        std::getline(file, line);
+        return line;
+    }
+
+    static int readInt(const std::string& path, int fallback) {
+        std::string line = readLine(path);
+        return line.empty() ? fallback : atoi(line.c_str());
+    }
+};
+
+/*
+ * Where a pool pins its workers:
+ *
+ *  - NONE:     threads are not pinned and float freely (the default).
+ *  - COMPACT:  fill one core complex (and each core's SMT siblings) before
+ *              moving on to the next, so workers share caches.
+ *  - SCATTER:  one worker per core, round-robin over packages and core
+ *              complexes, before doubling up on SMT siblings.
+ *  - EXPLICIT: worker i runs on cpus[i % cpus.size()].
+ *
+ * Workers beyond the number of CPUs wrap around.
+ */
+class PlacementPolicy {
+  public:
+    enum Mode { NONE, COMPACT, SCATTER, EXPLICIT };
+
+    Mode mode;
+    std::vector<int> cpus;
+
+    PlacementPolicy(Mode mode = NONE, const std::vector<int>& cpus = std::vector<int>())
+        : mode(mode), cpus(cpus) {}
+
+    // Accepts "none", "compact", "scatter" or a CPU list such as "0,2,4-7".
+    // Returns false, leaving policy alone, if spec is none of these.
+    static bool parse(const std::string& spec, PlacementPolicy& policy) {
+        if (spec == "none") {
+            policy = PlacementPolicy();
+        } else if (spec == "compact") {
+            policy = PlacementPolicy(COMPACT);
+        } else if (spec == "scatter") {
+            policy = PlacementPolicy(SCATTER);
+        } else if (isCpuList(spec)) {
+            policy = PlacementPolicy(EXPLICIT, CpuTopology::parseCpuList(spec));
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    // The CPU for each of numWorkers workers, or nothing if they are not pinned.
+    std::vector<CpuInfo> assign(int numWorkers) const {
+        std::vector<CpuInfo> order;
+        if (mode == NONE) {
+            return order;
+        }
+        std::vector<CpuInfo> topology = CpuTopology::load();
+        if (mode == COMPACT) {
+            order = topology;
+        } else if (mode == SCATTER) {
+            order = scatter(topology);
+        } else {
+            for (int cpu : cpus) {
+                CpuInfo info = {cpu, 0, cpu, cpu};
+                for (const CpuInfo& known : topology) {
+                    if (known.cpu == cpu) {
+                        info = known;
+                    }
+                }
+                order.push_back(info);
+            }
+        }
+
+        std::vector<CpuInfo> assignment;
+        for (int i = 0; i < numWorkers && !order.empty(); ++i) {
+            assignment.push_back(order[i % order.size()]);
+        }
+        return assignment;
+    }
+
+    // Returns false if the thread could not be pinned (or pinning is unsupported).
+    static bool pin(std::thread& thread, int cpu) {
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        return pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set) == 0;
+#else
+        return false;
+#endif
+    }
+
+    // pin() for a pool's worker workerId, warning on stderr if it fails so
+    // that a requested placement is never silently dropped.
+    static bool pinWorker(std::thread& thread, int workerId, int cpu) {
+        if (pin(thread, cpu)) {
+            return true;
+        }
+        fprintf(stderr, "Warning: could not pin worker %d to CPU %d, it runs unpinned\n", workerId, cpu);
+        return false;
+    }
+
+  private:
+    // Whether spec is a non-empty list of CPUs and ascending CPU ranges,
+    // such as "0,2,4-7", that pin() can express.
+    static bool isCpuList(const std::string& spec) {
+        size_t pos = 0;
+        do {
+            size_t comma = spec.find(',', pos);
+            std::string item = spec.substr(pos, comma == std::string::npos ? std::string::npos : comma - pos);
+            size_t dash = item.find('-');
+            std::string first = item.substr(0, dash);
+            std::string last = dash == std::string::npos ? first : item.substr(dash + 1);
+            if (!isCpu(first) || !isCpu(last) || atoi(first.c_str()) > atoi(last.c_str())) {
+                return false;
+            }
+            pos = comma == std::string::npos ? spec.size() + 1 : comma + 1;
+        } while (pos <= spec.size());
+        return true;
+    }
+
+    static bool isCpu(const std::string& number) {
+        if (number.empty() || number.size() > 6 ||
+            number.find_first_not_of("0123456789") != std::string::npos) {
+            return false;
+        }
+#ifdef __linux__
+        return atoi(number.c_str()) < CPU_SETSIZE;
+#else
+        return true;
+#endif
+    }
+
+    // Reorders a compact topology so that consecutive entries land on
+    // different packages, then different complexes, then different cores.
+    static std::vector<CpuInfo> scatter(const std::vector<CpuInfo>& topology) {
+        std::map<std::pair<int, int>, int> threadsPerCore;
+        std::map<int, int> coresPerComplex, complexesPerPackage;
+        std::map<std::pair<int, int>, int> coreRank;
+        std::map<int, int> complexRank;
+
+        std::vector<std::tuple<int, int, int, int, int> > keys;
+        for (size_t i = 0; i < topology.size(); ++i) {
+            const CpuInfo& info = topology[i];
+            std::pair<int, int> core(info.package, info.core);
+            if (!complexRank.count(info.complex)) {
+                complexRank[info.complex] = complexesPerPackage[info.package]++;
+            }
+            if (!coreRank.count(core)) {
+                coreRank[core] = coresPerComplex[info.complex]++;
+            }
+            int smtRank = threadsPerCore[core]++;
+            keys.push_back(std::make_tuple(smtRank, coreRank[core], complexRank[info.complex],
+                                           info.package, (int)i));
+        }
+        std::sort(keys.begin(), keys.end());
+
+        std::vector<CpuInfo> order;
+        for (const auto& key : keys) {
+            order.push_back(topology[std::get<4>(key)]);
+        }
+        return order;
+    }
+};
+
+#endif
@@ -0,0 +1,173 @@
+#ifndef _TASK_GRAPH_H
+#define _TASK_GRAPH_H
+
+#include "itasksys.h"
+#include <algorithm>
+#include <vector>
+
+/*
+ * TaskGraph: an immutable DAG of bulk launches, recorded once with a
+ * TaskGraphRecorder and replayed any number of times with
+ * ITaskSystem::runGraphAsync(). Nodes are numbered in recording order,
+ * which is a topological order since a launch can only depend on launches
+ * recorded before it. Edges are stored flattened (CSR) in both directions,
+ * together with each node's in-degree and the list of roots, so a task
+ * system can replay the graph without looking up or deduplicating deps.
+ */
+class TaskGraph {
+    friend class TaskGraphRecorder;
+
+    std::vector<IRunnable*> runnables_;
+    std::vector<int> numTotalTasks_;
+    std::vector<int> successorOffsets_;   // successors of node i are successors_[offsets[i], offsets[i+1])
+    std::vector<int> successors_;
+    std::vector<int> predecessorOffsets_;
+    std::vector<int> predecessors_;
+    std::vector<int> roots_;
+
+  public:
+    int size() const {
+        return static_cast<int>(numTotalTasks_.size());
+    }
+
+    // The runnable the node was recorded with
+    IRunnable* runnable(int node) const {
+        return runnables_[node];
+    }
+
+    int numTotalTasks(int node) const {
+        return numTotalTasks_[node];
+    }
+
+    const int* successorsBegin(int node) const {
+        return successors_.data() + successorOffsets_[node];
+    }
+
+    const int* successorsEnd(int node) const {
+        return successors_.data() + successorOffsets_[node + 1];
+    }
+
+    const int* predecessorsBegin(int node) const {
+        return predecessors_.data() + predecessorOffsets_[node];
+    }
+
+    const int* predecessorsEnd(int node) const {
+        return predecessors_.data() + predecessorOffsets_[node + 1];
+    }
+
+    int inDegree(int node) const {
+        return predecessorOffsets_[node + 1] - predecessorOffsets_[node];
+    }
+
+    // Nodes without predecessors, in recording order
+    const std::vector<int>& roots() const {
+        return roots_;
+    }
+};
+
+/*
+ * TaskGraphRecorder: an ITaskSystem that runs nothing and records the
+ * launches submitted to it instead. runAsyncWithDeps() returns the node
+ * index as the TaskID; deps must be TaskIDs returned by this recorder.
+ * sync() (and so run(), wait() and waitAny()) is recorded as a barrier:
+ * every later launch runs after every earlier one. graph() returns the
+ * recording as a TaskGraph.
+ */
+class TaskGraphRecorder: public ITaskSystem {
+    std::vector<IRunnable*> runnables_;
+    std::vector<int> numTotalTasks_;
+    std::vector<std::vector<int>> deps_;
+    std::vector<bool> hasSuccessors_;
+    std::vector<int> barrier_;   // launches every launch after the last sync() must follow
+    int firstAfterBarrier_;
+
+  public:
+    TaskGraphRecorder() : ITaskSystem(0), firstAfterBarrier_(0) {}
+    ~TaskGraphRecorder() {}
+
+    const char* name() {
+        return "Task Graph Recorder";
+    }
+
+    void run(IRunnable* runnable, int num_total_tasks) {
+        runAsyncWithDeps(runnable, num_total_tasks, std::vector<TaskID>());
+        sync();
+    }
+
+    TaskID runAsyncWithDeps(IRunnable* runnable, int num_total_tasks, const std::vector<TaskID>& deps) {
+        TaskID node = static_cast<TaskID>(numTotalTasks_.size());
+        std::vector<int> nodeDeps;
+        bool followsBarrier = false;
+        for (TaskID dep : deps) {
+            if (dep >= 0 && dep < node) {
+                nodeDeps.push_back(dep);
+                followsBarrier = followsBarrier || dep >= firstAfterBarrier_;
+            }
+        }
+        if (!followsBarrier) {
+            nodeDeps.insert(nodeDeps.end(), barrier_.begin(), barrier_.end());
+        }
+        std::sort(nodeDeps.begin(), nodeDeps.end());
+        nodeDeps.erase(std::unique(nodeDeps.begin(), nodeDeps.end()), nodeDeps.end());
+        for (int dep : nodeDeps) {
+            hasSuccessors_[dep] = true;
+        }
+
+        runnables_.push_back(runnable);
+        numTotalTasks_.push_back(num_total_tasks);
+        deps_.push_back(nodeDeps);
+        hasSuccessors_.push_back(false);
+        return node;
+    }
+
+    // Every earlier launch is an ancestor of one without successors, so
+    // those are the only ones later launches need to follow.
+    void sync() {
+        int size = static_cast<int>(numTotalTasks_.size());
+        if (firstAfterBarrier_ == size) {
+            return;
+        }
+        barrier_.clear();
+        for (int node = 0; node < size; ++node) {
+            if (!hasSuccessors_[node]) {
+                barrier_.push_back(node);
+            }
+        }
+        firstAfterBarrier_ = size;
+    }
+
+    TaskGraph graph() const {
+        TaskGraph graph;
+        int size = static_cast<int>(numTotalTasks_.size());
+        graph.runnables_ = runnables_;
+        graph.numTotalTasks_ = numTotalTasks_;
+
+        std::vector<int> outDegree(size, 0);
+        graph.predecessorOffsets_.push_back(0);
+        for (int node = 0; node < size; ++node) {
+            for (int dep : deps_[node]) {
+                graph.predecessors_.push_back(dep);
+                ++outDegree[dep];
+            }
+            graph.predecessorOffsets_.push_back(static_cast<int>(graph.predecessors_.size()));
+            if (deps_[node].empty()) {
+                graph.roots_.push_back(node);
+            }
+        }
+
+        graph.successorOffsets_.assign(size + 1, 0);
+        for (int node = 0; node < size; ++node) {
+            graph.successorOffsets_[node + 1] = graph.successorOffsets_[node] + outDegree[node];
+        }
+        graph.successors_.resize(graph.predecessors_.size());
+        std::vector<int> fill(graph.successorOffsets_.begin(), graph.successorOffsets_.end() - 1);
+        for (int node = 0; node < size; ++node) {
+            for (int dep : deps_[node]) {
+                graph.successors_[fill[dep]++] = node;
+            }
+        }
+        return graph;
+    }
+};
+
+#endif
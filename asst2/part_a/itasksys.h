@@ -22,6 +22,139 @@ class IRunnable {
         virtual void runTask(int task_id, int num_total_tasks) = 0;
 };
 
+/*
+  One entry of a batch passed to ITaskSystem::runAsyncBatchWithDeps().
+
+   - deps: TaskIDs returned by earlier runAsyncXXX calls.
+
+   - batch_deps: indices of earlier entries of the same batch, for edges
+     between launches whose TaskIDs are not known yet.
+
+   - priority: scheduling hint. Task systems that order ready launches
+     by the length of the dependency chain hanging off them add it to
+     that length, so a positive value makes the launch start earlier.
+ */
+struct BulkLaunch {
+    IRunnable* runnable;
+    int num_total_tasks;
+    std::vector<TaskID> deps;
+    std::vector<int> batch_deps;
+    int priority = 0;
+};
+
+/*
+  Scheduling counters for one thread of a task system, as returned by
+  ITaskSystem::workerStats(). Times are in seconds.
+
+   - worker_id: index of the worker thread, or -1 for the totals of
+     threads outside the pool that ran tasks while blocked in run(),
+     sync() or wait().
+
+   - lock_seconds: time spent blocked acquiring the task system's locks.
+
+   - wakeups: times the thread was woken up after going to sleep;
+     spurious_wakeups counts those that found nothing to run.
+     spin_wakeups counts times it found work before going to sleep.
+
+   - queue_depth_*: number of ready launches queued, sampled each
+     time the thread took one.
+ */
+struct WorkerStats {
+    int worker_id;
+    long long tasks_run;
+    double busy_seconds;
+    double idle_seconds;
+    double lock_seconds;
+    long long spin_wakeups;
+    long long wakeups;
+    long long spurious_wakeups;
+    long long queue_depth_samples;
+    double mean_queue_depth;
+};
+
+/*
+  Timeline of one bulk task launch, recorded while tracing is on (see
+  ITaskSystem::setTracing()). Times are CycleTimer::currentSeconds()
+  values.
+
+   - submit_time: the launch was passed to runXXX.
+   - ready_time: the last of its deps finished.
+   - first_start_time, last_finish_time: its first task started and
+     its last task finished running.
+ */
+struct LaunchTrace {
+    TaskID launch_id;
+    int num_total_tasks;
+    double submit_time;
+    double ready_time;
+    double first_start_time;
+    double last_finish_time;
+};
+
+/*
+  Task task_id of launch launch_id, run by worker worker_id (-1 for a
+  thread outside the pool) from start_time to end_time.
+ */
+struct TaskTrace {
+    TaskID launch_id;
+    int task_id;
+    int worker_id;
+    double start_time;
+    double end_time;
+};
+
+/*
+  One change in the number of worker threads of an elastic task
+  system, as returned by ITaskSystem::poolSizeEvents().
+
+   - time: CycleTimer::currentSeconds() at the change.
+   - num_threads: workers running after the change.
+   - grew: true if a worker was started because ready work backed up,
+     false if an idle one retired.
+   - queued: tickets in the ready queue when the decision was made.
+ */
+struct PoolSizeEvent {
+    double time;
+    int num_threads;
+    bool grew;
+    long long queued;
+};
+
+/*
+  Counters for one tenant of a task system that shares its workers
+  between tenants, as returned by ITaskSystem::tenantStats(). Times
+  are in seconds.
+
+   - tenant: 0 for launches submitted to the task system itself,
+     otherwise the index of the tenant() that submitted them.
+   - busy_seconds: worker time spent running the tenant's tasks.
+   - latency_*: from submission of a launch until its last task
+     finished, over the tenant's finished launches.
+ */
+struct TenantStats {
+    int tenant;
+    int weight;
+    long long launches;
+    double busy_seconds;
+    double mean_latency_seconds;
+    double max_latency_seconds;
+};
+
+/*
+  One task of a schedule recorded with
+  ITaskSystem::setScheduleRecording(): task task_id of launch
+  launch_id started on worker worker_id (-1 for a thread outside the
+  pool). launch_id counts the launches submitted since recording was
+  turned on, from 0.
+ */
+struct ScheduleEntry {
+    TaskID launch_id;
+    int task_id;
+    int worker_id;
+};
+
+class TaskGraph;
+
 class ITaskSystem {
     public:
         /*
@@ -63,10 +196,114 @@ class ITaskSystem {
         virtual TaskID runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
                                         const std::vector<TaskID>& deps) = 0;
 
+        /*
+          Submits a batch of asynchronous bulk task launches in one
+          call. Entry i behaves as if runAsyncWithDeps() had been
+          called for each entry in order, with the TaskIDs of the
+          entries listed in batch_deps added to its deps. The TaskID
+          of entry i is stored in task_ids[i].
+
+          The default implementation does exactly that; task systems
+          may override it to register the whole graph at once.
+         */
+        virtual void runAsyncBatchWithDeps(const std::vector<BulkLaunch>& launches,
+                                           std::vector<TaskID>& task_ids);
+
+        /*
+          Submits every launch of a recorded TaskGraph (see
+          TaskGraph.h), as if runAsyncWithDeps() had been called for
+          each node in order with the TaskIDs of its predecessors as
+          deps. The graph's roots also depend on deps. runnables[i],
+          if present and not null, replaces the runnable node i was
+          recorded with. The TaskID of node i is stored in task_ids[i].
+          graph must stay alive until those launches are done.
+
+          The default implementation does exactly that; task systems
+          may override it to use the graph's precomputed topology.
+         */
+        virtual void runGraphAsync(const TaskGraph& graph, const std::vector<IRunnable*>& runnables,
+                                   const std::vector<TaskID>& deps, std::vector<TaskID>& task_ids);
+
         /*
           Blocks until all tasks created as a result of **any prior**
           runXXX calls are done.
          */
         virtual void sync() = 0;
+
+        /*
+          Blocks until the launch identified by task_id (or, for
+          waitAny(), at least one of task_ids) is done. waitAny()
+          returns the TaskID it waited for, or -1 if task_ids is empty.
+
+          The default implementations fall back to sync().
+         */
+        virtual void wait(TaskID task_id);
+        virtual TaskID waitAny(const std::vector<TaskID>& task_ids);
+
+        /*
+          Fills stats with the counters accumulated since the task system
+          was created, one entry per thread that keeps them. The default
+          implementation reports nothing.
+         */
+        virtual void workerStats(std::vector<WorkerStats>& stats);
+
+        /*
+          Fills events with every change in the number of worker
+          threads so far, oldest first. Task systems with a fixed
+          number of workers report nothing.
+         */
+        virtual void poolSizeEvents(std::vector<PoolSizeEvent>& events);
+
+        /*
+          Returns a task system that submits to this one's workers on
+          behalf of a new tenant with the given weight (at least 1).
+          Task systems that share their workers fairly give every tenant
+          with ready work a share of worker time proportional to its
+          weight, and sync() on the returned system waits only for that
+          tenant's launches. It belongs to this task system and stays
+          valid until this one is destroyed. tenantStats() reports the
+          tenants so far. Returns nullptr if this task system cannot take
+          any more tenants.
+
+          The default implementations return this task system itself
+          and report nothing.
+         */
+        virtual ITaskSystem* tenant(int weight);
+        virtual void tenantStats(std::vector<TenantStats>& stats);
+
+        /*
+          Turns timeline recording on or off. Turning it on discards
+          anything recorded before. traceEvents() returns what has been
+          recorded so far, and should only be called once all launches
+          have finished (e.g. after sync()). Task systems that do not
+          record anything return empty vectors.
+         */
+        virtual void setTracing(bool enabled);
+        virtual void traceEvents(std::vector<LaunchTrace>& launches,
+                                 std::vector<TaskTrace>& tasks);
+
+        /*
+          Schedule recording and replay, to reproduce a run whose
+          outcome depends on how its tasks were interleaved. While
+          recording is on, the task system logs which thread started
+          which task, in the order they started. Turning it on discards
+          anything recorded before. recordedSchedule() returns the log
+          and should only be called once all launches have finished.
+
+          replaySchedule() makes the launches submitted after it follow
+          schedule: each task starts on the thread it is listed with,
+          and in the listed order. The launches must be submitted as in
+          the recorded run. That holds for the same program with the
+          same number of threads, as long as only one thread outside
+          the pool submits launches. Once the schedule is used up, or
+          the run stops matching it, the task system schedules the rest
+          on its own. Call it while no launches are running.
+
+          Task systems that do not record schedules return an empty one
+          and ignore replaySchedule().
+         */
+        virtual void setScheduleRecording(bool enabled);
+        virtual void recordedSchedule(std::vector<ScheduleEntry>& schedule);
+        virtual void replaySchedule(const std::vector<ScheduleEntry>& schedule);
 };
 #endif
@@ -1,4 +1,7 @@
 #include "tasksys.h"
+#include "CycleTimer.h"
+#include "AdaptiveChunk.h"
+#include "TaskGraph.h"
 #include <iostream>
 
 
@@ -7,6 +10,79 @@ IRunnable::~IRunnable() {}
 ITaskSystem::ITaskSystem(int num_threads) {}
 ITaskSystem::~ITaskSystem() {}
 
+void ITaskSystem::runAsyncBatchWithDeps(const std::vector<BulkLaunch>& launches,
+                                        std::vector<TaskID>& task_ids) {
+    task_ids.resize(launches.size());
+    for (size_t i = 0; i < launches.size(); i++) {
+        std::vector<TaskID> deps = launches[i].deps;
+        for (int idx : launches[i].batch_deps) {
+            deps.push_back(task_ids[idx]);
+        }
+        task_ids[i] = runAsyncWithDeps(launches[i].runnable, launches[i].num_total_tasks, deps);
+    }
+}
+
+void ITaskSystem::runGraphAsync(const TaskGraph& graph, const std::vector<IRunnable*>& runnables,
+                                const std::vector<TaskID>& deps, std::vector<TaskID>& task_ids) {
+    task_ids.resize(graph.size());
+    std::vector<TaskID> nodeDeps;
+    for (int node = 0; node < graph.size(); node++) {
+        nodeDeps.clear();
+        if (graph.inDegree(node) == 0) {
+            nodeDeps = deps;
+        }
+        for (const int* pred = graph.predecessorsBegin(node); pred != graph.predecessorsEnd(node); ++pred) {
+            nodeDeps.push_back(task_ids[*pred]);
+        }
+        IRunnable* runnable = node < (int)runnables.size() && runnables[node] ? runnables[node] : graph.runnable(node);
+        task_ids[node] = runAsyncWithDeps(runnable, graph.numTotalTasks(node), nodeDeps);
+    }
+}
+
+void ITaskSystem::wait(TaskID task_id) {
+    sync();
+}
+
+TaskID ITaskSystem::waitAny(const std::vector<TaskID>& task_ids) {
+    if (task_ids.empty()) {
+        return -1;
+    }
+    sync();
+    return task_ids[0];
+}
+
+void ITaskSystem::workerStats(std::vector<WorkerStats>& stats) {
+    stats.clear();
+}
+
+void ITaskSystem::poolSizeEvents(std::vector<PoolSizeEvent>& events) {
+    events.clear();
+}
+
+ITaskSystem* ITaskSystem::tenant(int weight) {
+    return this;
+}
+
+void ITaskSystem::tenantStats(std::vector<TenantStats>& stats) {
+    stats.clear();
+}
+
+void ITaskSystem::setTracing(bool enabled) {}
+
+void ITaskSystem::traceEvents(std::vector<LaunchTrace>& launches,
+                              std::vector<TaskTrace>& tasks) {
+    launches.clear();
+    tasks.clear();
+}
+
+void ITaskSystem::setScheduleRecording(bool enabled) {}
+
+void ITaskSystem::recordedSchedule(std::vector<ScheduleEntry>& schedule) {
+    schedule.clear();
+}
+
+void ITaskSystem::replaySchedule(const std::vector<ScheduleEntry>& schedule) {}
+
 /*
  * ================================================================
  * Serial task system implementation
@@ -111,6 +187,108 @@ void TaskSystemParallelSpawn::sync() {
     return;
 }
 
+/*
+ * ================================================================
+ * Parallel Persistent Spawn Task System Implementation
+ * ================================================================
+ */
+
+const char* TaskSystemParallelSpawnPersistent::name() {
+    return "Parallel + Persistent Spawn";
+}
+
+TaskSystemParallelSpawnPersistent::TaskSystemParallelSpawnPersistent(int num_threads):
+    ITaskSystem(num_threads),
+    numThreads(std::max(1, num_threads)),
+    stopFlag(false),
+    generation(0),
+    busyWorkers(0),
+    runnable(nullptr),
+    totalTasks(0) {
+    // the caller of run() is the last of the numThreads threads
+    threadPool.reserve(numThreads - 1);
+    for (int i = 0; i < numThreads - 1; ++i) {
+        threadPool.emplace_back(&TaskSystemParallelSpawnPersistent::workerThread, this);
+    }
+}
+
+TaskSystemParallelSpawnPersistent::~TaskSystemParallelSpawnPersistent() {
+    {
+        std::lock_guard<std::mutex> lock(launchMutex);
+        stopFlag = true;
+    }
+    launchReady.notify_all();
+    for (auto& thread : threadPool) {
+        thread.join();
+    }
+}
+
+void TaskSystemParallelSpawnPersistent::runTasks(IRunnable* runnable, int num_total_tasks) {
+    while (true) {
+        int i = nextTask.fetch_add(1, std::memory_order_relaxed);
+        if (i >= num_total_tasks) break;
+        runnable->runTask(i, num_total_tasks);
+    }
+}
+
+void TaskSystemParallelSpawnPersistent::workerThread() {
+    unsigned long seen = 0;
+    std::unique_lock<std::mutex> lock(launchMutex);
+    while (true) {
+        launchReady.wait(lock, [&]() { return stopFlag || generation != seen; });
+        if (stopFlag) {
+            return;
+        }
+        seen = generation;
+        IRunnable* current = runnable;
+        int total = totalTasks;
+        lock.unlock();
+
+        runTasks(current, total);
+
+        lock.lock();
+        if (--busyWorkers == 0) {
+            workersDone.notify_one();
+        }
+    }
+}
+
+void TaskSystemParallelSpawnPersistent::run(IRunnable* runnable, int num_total_tasks) {
+    if (threadPool.empty() || num_total_tasks <= 1) {
+        for (int i = 0; i < num_total_tasks; i++) {
+            runnable->runTask(i, num_total_tasks);
+        }
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(launchMutex);
+        this->runnable = runnable;
+        totalTasks = num_total_tasks;
+        nextTask.store(0, std::memory_order_relaxed);
+        busyWorkers = (int)threadPool.size();
+        ++generation;
+    }
+    launchReady.notify_all();
+
+    runTasks(runnable, num_total_tasks);
+
+    // every worker must be done with this launch before the next one resets nextTask
+    std::unique_lock<std::mutex> lock(launchMutex);
+    workersDone.wait(lock, [&]() { return busyWorkers == 0; });
+}
+
+TaskID TaskSystemParallelSpawnPersistent::runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
+                                                           const std::vector<TaskID>& deps) {
+    // You do not need to implement this method.
+    return 0;
+}
+
+void TaskSystemParallelSpawnPersistent::sync() {
+    // You do not need to implement this method.
+    return;
+}
+
 /*
  * ================================================================
  * Parallel Thread Pool Spinning Task System Implementation
@@ -155,14 +333,15 @@ const char* TaskSystemParallelThreadPoolSpinning::name() {
 //     }
 // }
 
-TaskSystemParallelThreadPoolSpinning::TaskSystemParallelThreadPoolSpinning(int num_threads): 
+TaskSystemParallelThreadPoolSpinning::TaskSystemParallelThreadPoolSpinning(int num_threads,
+                                                                           const PlacementPolicy& placement): 
         ITaskSystem(num_threads), 
         numThreads(num_threads),
         stopFlag(false),
         currentTaskId(0),
-        completedTasks(0),
         runnable(nullptr),
-        totalTasks(0){
+        totalTasks(0),
+        completedTasks(num_threads + 1){
     //
     // TODO: CS149 student implementations may decide to perform setup
     // operations (such as thread pool construction) here.
@@ -170,38 +349,70 @@ TaskSystemParallelThreadPoolSpinning::TaskSystemParallelThreadPoolSpinning(int n
     // (requiring changes to tasksys.h).
     //
     threadPool.reserve(numThreads);
+    std::vector<CpuInfo> workerCpus = placement.assign(numThreads);
     // std::cout << "Enter run function" << std::endl; no io output since python script does not output it
     for (int i = 0; i < numThreads; ++i) {
-        threadPool.emplace_back([this] {
+        threadPool.emplace_back([this, i] {
             while (true) { // Calling constructor would let the thread all run while (true) but does not execute the code below 
                             // until the run function is called, which assigns runnable and taskId
-                IRunnable* currentRunnable = nullptr;
-                int taskId = -1;
-                {
-                    std::lock_guard<std::mutex> lock(taskMutex);
-                    if (runnable && currentTaskId < totalTasks) {
-                        taskId = currentTaskId++;
-                        currentRunnable = runnable;
-                        if (currentTaskId >= totalTasks) {
-                            runnable = nullptr;
-                        }
-                    }
-                }
-
-                if (currentRunnable) { // if there is assigned task, then run them, and increase completedTasks
-                    currentRunnable->runTask(taskId, totalTasks);
-                    completedTasks.fetch_add(1);
-                }
-                else if (stopFlag) {
+                if (!runNextChunk(i) && stopFlag) {
                     break;
                 }
-                
             }
         });
+        if (!workerCpus.empty()) {
+            PlacementPolicy::pinWorker(threadPool.back(), i, workerCpus[i].cpu);
+        }
     }
     
 }
 
+// Claims the next chunk of the current launch and runs it. Used by the pool
+// threads and by the thread inside run(), so the caller does useful work
+// instead of just spinning on completedTasks. slot is the calling thread's
+// completion counter.
+bool TaskSystemParallelThreadPoolSpinning::runNextChunk(int slot) {
+    IRunnable* currentRunnable = nullptr;
+    int taskId = -1;
+    int count = 0;
+    int total = 0;
+    {
+        std::lock_guard<std::mutex> lock(taskMutex);
+        if (runnable && currentTaskId < totalTasks) {
+            taskId = currentTaskId;
+            count = AdaptiveChunk::size(totalTasks - taskId, numThreads, secondsPerTask);
+            currentTaskId += count;
+            total = totalTasks;
+            currentRunnable = runnable;
+            if (currentTaskId >= totalTasks) {
+                runnable = nullptr;
+            }
+        }
+    }
+
+    if (!currentRunnable) {
+        return false;
+    }
+
+    // run the assigned tasks, and increase completedTasks
+    double startTime = CycleTimer::currentSeconds();
+    for (int i = taskId; i < taskId + count; ++i) {
+        currentRunnable->runTask(i, total);
+    }
+    double sample = (CycleTimer::currentSeconds() - startTime) / count;
+    secondsPerTask = AdaptiveChunk::update(secondsPerTask, sample);
+    completedTasks[slot].count.fetch_add(count);
+    return true;
+}
+
+int TaskSystemParallelThreadPoolSpinning::completedSum() const {
+    int sum = 0;
+    for (const Completed& completed : completedTasks) {
+        sum += completed.count.load();
+    }
+    return sum;
+}
+
 TaskSystemParallelThreadPoolSpinning::~TaskSystemParallelThreadPoolSpinning() {
     // if destructor is called, stop running and assining, end the loop
     stopFlag.store(true);
@@ -227,12 +438,15 @@ void TaskSystemParallelThreadPoolSpinning::run(IRunnable* runnable, int num_tota
         this->runnable = runnable;
         this->totalTasks = num_total_tasks;
         this->currentTaskId = 0;
-        this->completedTasks = 0;
+        for (Completed& completed : completedTasks) { // every task of the last launch has finished
+            completed.count = 0;
+        }
+        this->secondsPerTask = 0.0; // new runnable, measure its cost from scratch
     }
 
-    // after assigning, notifying all threads
-    while (completedTasks.load() < num_total_tasks) {
-        
+    // help the pool until every index is claimed, then wait for the rest
+    while (completedSum() < num_total_tasks) {
+        runNextChunk(numThreads);
     }
 }
 
@@ -258,7 +472,8 @@ const char* TaskSystemParallelThreadPoolSleeping::name() {
     return "Parallel + Thread Pool + Sleep";
 }
 
-TaskSystemParallelThreadPoolSleeping::TaskSystemParallelThreadPoolSleeping(int num_threads): 
+TaskSystemParallelThreadPoolSleeping::TaskSystemParallelThreadPoolSleeping(int num_threads,
+                                                                           const PlacementPolicy& placement): 
         ITaskSystem(num_threads),
         numThreads(num_threads),
         runnable(nullptr),
@@ -271,37 +486,46 @@ TaskSystemParallelThreadPoolSleeping::TaskSystemParallelThreadPoolSleeping(int n
     // (requiring changes to tasksys.h).
     //
     threadPool.reserve(num_threads);
+    std::vector<CpuInfo> workerCpus = placement.assign(num_threads);
     for (int i = 0; i < num_threads; ++i) {
         threadPool.emplace_back([this] () {
+            std::unique_lock<std::mutex> grd(taskMutex);
             while (true) {
-                int taskId = -1;
-
-                if (completedTasks >= totalTasks) { //之前没有这个if好像会有 mainthread丢失notify信号的情况导致infinite while loop
-                    completeAll.notify_one();
+                while (!stopFlag && currentTaskId >= totalTasks) {
+                    ++idleWorkers;
+                    taskAvailable.wait(grd);
+                    --idleWorkers;
+                    pendingWakeups = std::max(0, pendingWakeups - 1);
                 }
-
-                {
-                    std::unique_lock<std::mutex> grd(taskMutex);
-                    taskAvailable.wait(grd, [this](){return runnable != nullptr || stopFlag.load();}); 
-                    if (currentTaskId < totalTasks) {
-                        taskId = currentTaskId++;
-                    }
-                }
-                
-     
-                if (taskId != -1) {
-                    runnable->runTask(taskId, totalTasks);
-                    completedTasks.fetch_add(1);
-                    if (completedTasks >= totalTasks) { 
-                        completeAll.notify_one();
-                    }
-                } 
-                else if (stopFlag) {
+                if (stopFlag) {
                     break;
                 }
 
+                int total = totalTasks;
+                int taskId = currentTaskId;
+                int count = AdaptiveChunk::size(total - taskId, numThreads, secondsPerTask);
+                currentTaskId += count;
+                wakeIdle(total - currentTaskId); // chain-wake for what this chunk leaves
+                IRunnable* current = runnable;
+                grd.unlock();
+
+                double startTime = CycleTimer::currentSeconds();
+                for (int i = taskId; i < taskId + count; ++i) {
+                    current->runTask(i, total);
+                }
+                double sample = (CycleTimer::currentSeconds() - startTime) / count;
+                secondsPerTask = AdaptiveChunk::update(secondsPerTask, sample);
+
+                grd.lock();
+                completedTasks += count;
+                if (completedTasks == total) {
+                    completeAll.notify_one();
+                }
             }
         });
+        if (!workerCpus.empty()) {
+            PlacementPolicy::pinWorker(threadPool.back(), i, workerCpus[i].cpu);
+        }
     }
 }
 
@@ -323,6 +547,18 @@ TaskSystemParallelThreadPoolSleeping::~TaskSystemParallelThreadPoolSleeping() {
     }
 }
 
+/*
+ * Called with taskMutex held. Wakes one idle worker per task index in work,
+ * not counting workers that have been notified but are not running yet.
+ */
+void TaskSystemParallelThreadPoolSleeping::wakeIdle(int work) {
+    int wake = std::min(work, idleWorkers - pendingWakeups);
+    for (int i = 0; i < wake; ++i) {
+        taskAvailable.notify_one();
+    }
+    pendingWakeups += std::max(0, wake);
+}
+
 void TaskSystemParallelThreadPoolSleeping::run(IRunnable* runnable, int num_total_tasks) {
 
 
@@ -333,26 +569,17 @@ void TaskSystemParallelThreadPoolSleeping::run(IRunnable* runnable, int num_tota
     //    for (int i = 0; i < num_total_tasks; i++) {
     //     runnable->runTask(i, num_total_tasks);
     // }
-    // {
-    //     std::unique_lock<std::mutex> lock(taskMutex);
-        
-    // }
+    std::unique_lock<std::mutex> lock(taskMutex);
     this->runnable = runnable; 
     this->totalTasks = num_total_tasks;
     this->currentTaskId = 0;
     this->completedTasks = 0;
-    this->taskAvailable.notify_all();
-    
+    this->secondsPerTask = 0.0;
+    wakeIdle(num_total_tasks);
 
-
-    std::unique_lock<std::mutex> lock(taskMutex);
     completeAll.wait(lock, [this] () {
         return completedTasks >= totalTasks;
     });
-
-    // while (true) {
-    //     std::cout << "it reaches here" << std::endl;
-    // } It reaches here but thread are not performing tasks
 }
 
 TaskID TaskSystemParallelThreadPoolSleeping::runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
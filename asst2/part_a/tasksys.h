@@ -1,7 +1,12 @@
 #ifndef _TASKSYS_H
 #define _TASKSYS_H
 
+// Let the shared test driver register TaskSystemParallelSpawnPersistent
+#define TASKSYS_HAS_PERSISTENT_SPAWN
+
 #include "itasksys.h"
+#include "Placement.h"
+#include "CacheLine.h"
 #include <queue>
 #include <mutex>
 #include <condition_variable>  
@@ -43,6 +48,39 @@ class TaskSystemParallelSpawn: public ITaskSystem {
         void sync();
 };
 
+/*
+ * TaskSystemParallelSpawnPersistent: a drop-in for TaskSystemParallelSpawn
+ * that creates its threads once instead of in every run() call. Between
+ * calls they are parked on a condition variable, so like the spawning
+ * version it uses no CPU while idle. run() wakes numThreads - 1 of them,
+ * takes part itself, and returns once every woken thread has checked back
+ * in, so nothing touches the runnable after run() returns. The destructor
+ * wakes and joins the threads.
+ */
+class TaskSystemParallelSpawnPersistent: public ITaskSystem {
+    int numThreads;
+    std::vector<std::thread> threadPool;
+    std::mutex launchMutex;
+    std::condition_variable launchReady;          // workers park here between run() calls
+    std::condition_variable workersDone;          // run() waits here for the last worker
+    bool stopFlag;
+    unsigned long generation;                     // bumped by every run(), guarded by launchMutex
+    int busyWorkers;                              // workers still in the current run()
+    IRunnable* runnable;
+    int totalTasks;
+    alignas(CACHE_LINE_SIZE) std::atomic<int> nextTask{0};
+    void workerThread();
+    void runTasks(IRunnable* runnable, int num_total_tasks);
+    public:
+        TaskSystemParallelSpawnPersistent(int num_threads);
+        ~TaskSystemParallelSpawnPersistent();
+        const char* name();
+        void run(IRunnable* runnable, int num_total_tasks);
+        TaskID runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
+                                const std::vector<TaskID>& deps);
+        void sync();
+};
+
 /*
  * TaskSystemParallelThreadPoolSpinning: This class is the student's
  * implementation of a parallel task execution engine that uses a
@@ -55,14 +93,24 @@ class TaskSystemParallelThreadPoolSpinning: public ITaskSystem {
     // std::unique_ptr<std::vector<std::thread>> threadPool report error, 
     // might be that when the thread finish one task, then it is destroyed
     // std::queue<std::function<void()>> tasks;
-    std::atomic<bool> stopFlag;                   // flag that tells if all tasks done
+    // Each slot counts the tasks one thread finished in the current launch,
+    // so finishing a chunk writes only that thread's line. run() sums them.
+    struct alignas(CACHE_LINE_SIZE) Completed {
+        std::atomic<int> count{0};
+    };
+
+    std::atomic<bool> stopFlag;                   // flag that tells if all tasks done, read-mostly
+    // written on every claim, kept away from the state the other threads poll
+    alignas(CACHE_LINE_SIZE) std::mutex taskMutex;
     std::atomic<int> currentTaskId;             
-    std::atomic<int> completedTasks;              // number of completed tasks
     IRunnable* runnable;                          // current task
     int totalTasks;                               
-    std::mutex taskMutex;                         
+    alignas(CACHE_LINE_SIZE) std::atomic<double> secondsPerTask{0.0}; // measured cost of one task, sizes the chunks
+    std::vector<Completed> completedTasks;        // per thread, the last slot is run()'s caller
+    bool runNextChunk(int slot);                  // claims and runs one chunk, false if none left
+    int completedSum() const;
     public:
-        TaskSystemParallelThreadPoolSpinning(int num_threads);
+        TaskSystemParallelThreadPoolSpinning(int num_threads, const PlacementPolicy& placement = PlacementPolicy());
         ~TaskSystemParallelThreadPoolSpinning();
         const char* name();
         void run(IRunnable* runnable, int num_total_tasks);
@@ -88,10 +136,16 @@ class TaskSystemParallelThreadPoolSleeping: public ITaskSystem {
     std::atomic<int> totalTasks{0};
     std::atomic<int> stopFlag;
     std::atomic<int> completedTasks;
+    std::atomic<double> secondsPerTask{0.0};      // measured cost of one task, sizes the chunks
     std::condition_variable completeAll;
+    // Wakeups are sized to the work: one worker per task index left, and a
+    // woken worker passes on what its chunk leaves. Both guarded by taskMutex.
+    int idleWorkers{0};                           // waiting on taskAvailable
+    int pendingWakeups{0};                        // notified but not running yet
+    void wakeIdle(int work);
 
     public:
-        TaskSystemParallelThreadPoolSleeping(int num_threads);
+        TaskSystemParallelThreadPoolSleeping(int num_threads, const PlacementPolicy& placement = PlacementPolicy());
         ~TaskSystemParallelThreadPoolSleeping();
         const char* name();
         void run(IRunnable* runnable, int num_total_tasks);
@@ -1,11 +1,89 @@
 #include "tasksys.h"
+#include "CycleTimer.h"
+#include "AdaptiveChunk.h"
+#include "TaskGraph.h"
 #include <algorithm>
+#include <tuple>
+#include <cstdint>
 
 IRunnable::~IRunnable() {}
 
 ITaskSystem::ITaskSystem(int num_threads) {}
 ITaskSystem::~ITaskSystem() {}
 
+void ITaskSystem::runAsyncBatchWithDeps(const std::vector<BulkLaunch>& launches,
+                                        std::vector<TaskID>& task_ids) {
+    task_ids.resize(launches.size());
+    for (size_t i = 0; i < launches.size(); i++) {
+        std::vector<TaskID> deps = launches[i].deps;
+        for (int idx : launches[i].batch_deps) {
+            deps.push_back(task_ids[idx]);
+        }
+        task_ids[i] = runAsyncWithDeps(launches[i].runnable, launches[i].num_total_tasks, deps);
+    }
+}
+
+void ITaskSystem::runGraphAsync(const TaskGraph& graph, const std::vector<IRunnable*>& runnables,
+                                const std::vector<TaskID>& deps, std::vector<TaskID>& task_ids) {
+    task_ids.resize(graph.size());
+    std::vector<TaskID> nodeDeps;
+    for (int node = 0; node < graph.size(); node++) {
+        nodeDeps.clear();
+        if (graph.inDegree(node) == 0) {
+            nodeDeps = deps;
+        }
+        for (const int* pred = graph.predecessorsBegin(node); pred != graph.predecessorsEnd(node); ++pred) {
+            nodeDeps.push_back(task_ids[*pred]);
+        }
+        IRunnable* runnable = node < (int)runnables.size() && runnables[node] ? runnables[node] : graph.runnable(node);
+        task_ids[node] = runAsyncWithDeps(runnable, graph.numTotalTasks(node), nodeDeps);
+    }
+}
+
+void ITaskSystem::wait(TaskID task_id) {
+    sync();
+}
+
+TaskID ITaskSystem::waitAny(const std::vector<TaskID>& task_ids) {
+    if (task_ids.empty()) {
+        return -1;
+    }
+    sync();
+    return task_ids[0];
+}
+
+void ITaskSystem::workerStats(std::vector<WorkerStats>& stats) {
+    stats.clear();
+}
+
+void ITaskSystem::poolSizeEvents(std::vector<PoolSizeEvent>& events) {
+    events.clear();
+}
+
+ITaskSystem* ITaskSystem::tenant(int weight) {
+    return this;
+}
+
+void ITaskSystem::tenantStats(std::vector<TenantStats>& stats) {
+    stats.clear();
+}
+
+void ITaskSystem::setTracing(bool enabled) {}
+
+void ITaskSystem::traceEvents(std::vector<LaunchTrace>& launches,
+                              std::vector<TaskTrace>& tasks) {
+    launches.clear();
+    tasks.clear();
+}
+
+void ITaskSystem::setScheduleRecording(bool enabled) {}
+
+void ITaskSystem::recordedSchedule(std::vector<ScheduleEntry>& schedule) {
+    schedule.clear();
+}
+
+void ITaskSystem::replaySchedule(const std::vector<ScheduleEntry>& schedule) {}
+
 /*
  * ================================================================
  * Serial task system implementation
@@ -88,7 +166,9 @@ const char* TaskSystemParallelThreadPoolSpinning::name() {
     return "Parallel + Thread Pool + Spin";
 }
 
-TaskSystemParallelThreadPoolSpinning::TaskSystemParallelThreadPoolSpinning(int num_threads): ITaskSystem(num_threads) {
+TaskSystemParallelThreadPoolSpinning::TaskSystemParallelThreadPoolSpinning(int num_threads,
+                                                                           const PlacementPolicy& placement)
+    : ITaskSystem(num_threads) {
     // NOTE: CS149 students are not expected to implement TaskSystemParallelThreadPoolSpinning in Part B.
 }
 
@@ -125,326 +205,1948 @@ void TaskSystemParallelThreadPoolSpinning::sync() {
 const char* TaskSystemParallelThreadPoolSleeping::name() {
     return "Parallel + Thread Pool + Sleep";
 }
+/*
+ * LaunchQueue implementation
+ */
+LaunchQueue::LaunchQueue(size_t capacity)
+    : cells(new Cell[capacity]), mask(capacity - 1)
+{
+    for (size_t i = 0; i < capacity; ++i) {
+        cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+bool LaunchQueue::tryPush(Launch* launch) {
+    size_t pos = enqueuePos.load(std::memory_order_relaxed);
+    while (true) {
+        Cell& cell = cells[pos & mask];
+        size_t seq = cell.sequence.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            // cell is free for this lap, try to claim the slot
+            if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                cell.launch = launch;
+                cell.sequence.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false; // ring is full
+        } else {
+            pos = enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+bool LaunchQueue::tryPop(Launch*& launch) {
+    size_t pos = dequeuePos.load(std::memory_order_relaxed);
+    while (true) {
+        Cell& cell = cells[pos & mask];
+        size_t seq = cell.sequence.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (diff == 0) {
+            // cell holds a value for this lap, try to take it
+            if (dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                launch = cell.launch;
+                cell.sequence.store(pos + mask + 1, std::memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false; // ring is empty
+        } else {
+            pos = dequeuePos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void LaunchQueue::push(Launch* launch) {
+    if (overflowSize.load() == 0 && tryPush(launch)) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(overflowMutex);
+    overflow.push_back(launch);
+    overflowSize.fetch_add(1);
+}
+
+bool LaunchQueue::pop(Launch*& launch) {
+    if (tryPop(launch)) {
+        return true;
+    }
+    if (overflowSize.load() == 0) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(overflowMutex);
+    if (overflow.empty()) {
+        return false;
+    }
+    launch = overflow.front();
+    overflow.pop_front();
+    overflowSize.fetch_sub(1);
+    return true;
+}
+
+bool LaunchQueue::empty() const {
+    return enqueuePos.load() == dequeuePos.load() && overflowSize.load() == 0;
+}
+
+size_t LaunchQueue::sizeApprox() const {
+    size_t dequeued = dequeuePos.load(std::memory_order_relaxed);
+    size_t enqueued = enqueuePos.load(std::memory_order_relaxed);
+    return (enqueued > dequeued ? enqueued - dequeued : 0) + overflowSize.load(std::memory_order_relaxed);
+}
+
+/*
+ * Launch and LaunchTable implementation
+ */
+void Launch::reset(TaskID launchID, IRunnable* launchRunnable, int launchTotalTasks) {
+    id = launchID;
+    runnable = launchRunnable;
+    numTotalTasks = launchTotalTasks;
+    nextTask.store(0, std::memory_order_relaxed);
+    finishedTasks.store(0, std::memory_order_relaxed);
+    secondsPerTask.store(0.0, std::memory_order_relaxed);
+    refs.store(1, std::memory_order_relaxed);
+    live = true;
+    pendingDeps = 0;
+    done = false;
+    successors.clear();
+    deps.clear();
+    graph = nullptr;
+    tenant = 0;
+    replayed.clear();
+    weight = 1;
+    priority = 1;
+    submitTime = 0.0;
+    readyTime = 0.0;
+    firstStartTime.store(0.0, std::memory_order_relaxed);
+}
+
+LaunchTable::LaunchTable(size_t capacity)
+    : slots(capacity), mask(capacity - 1)
+{
+    for (auto& slot : slots) {
+        slot.reset(new Launch());
+    }
+}
+
+Launch& LaunchTable::create(TaskID id, IRunnable* runnable, int numTotalTasks) {
+    while (slots[id & mask]->live) {
+        grow();
+    }
+    Launch& launch = *slots[id & mask];
+    launch.reset(id, runnable, numTotalTasks);
+    return launch;
+}
+
+Launch* LaunchTable::find(TaskID id) {
+    Launch* launch = slots[id & mask].get();
+    return launch && launch->live && launch->id == id ? launch : nullptr;
+}
+
+void LaunchTable::release(Launch& launch) {
+    launch.live = false;
+}
+
+/*
+ * Doubles the table. Records that shared no slot before share none after,
+ * since their ids already differed in the low bits. A record that never
+ * held a launch has id -1 and keeps its index.
+ */
+void LaunchTable::grow() {
+    std::vector<std::unique_ptr<Launch>> bigger(slots.size() * 2);
+    size_t biggerMask = bigger.size() - 1;
+    for (size_t i = 0; i < slots.size(); ++i) {
+        size_t index = slots[i]->id < 0 ? i : slots[i]->id & biggerMask;
+        bigger[index] = std::move(slots[i]);
+    }
+    for (auto& slot : bigger) {
+        if (!slot) {
+            slot.reset(new Launch());
+        }
+    }
+    slots.swap(bigger);
+    mask = biggerMask;
+}
+
+/*
+ * PriorityLaunchQueue implementation
+ */
+PriorityLaunchQueue::PriorityLaunchQueue(size_t capacityPerLevel) {
+    for (int i = 0; i < numLevels; ++i) {
+        levels.emplace_back(new LaunchQueue(capacityPerLevel));
+    }
+}
+
+int PriorityLaunchQueue::levelOf(int priority) {
+    int level = 0;
+    while (priority > 1 && level < numLevels - 1) {
+        priority >>= 1;
+        ++level;
+    }
+    return level;
+}
+
+void PriorityLaunchQueue::push(Launch* launch, int level) {
+    levels[level]->push(launch);
+    nonEmpty.fetch_or(1u << level); // after the push, see pop()
+}
+
+bool PriorityLaunchQueue::pop(Launch*& launch) {
+    unsigned mask = nonEmpty.load();
+    while (mask != 0) {
+        int level = 31 - __builtin_clz(mask);
+        if (levels[level]->pop(launch)) {
+            return true;
+        }
+        // Looks empty: clear its bit, then look again. A push that lands
+        // after that second look sets the bit again itself.
+        nonEmpty.fetch_and(~(1u << level));
+        if (!levels[level]->empty()) {
+            nonEmpty.fetch_or(1u << level);
+            continue;
+        }
+        mask &= ~(1u << level);
+    }
+    return false;
+}
+
+bool PriorityLaunchQueue::empty() const {
+    for (const auto& level : levels) {
+        if (!level->empty()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t PriorityLaunchQueue::sizeApprox() const {
+    size_t size = 0;
+    for (const auto& level : levels) {
+        size += level->sizeApprox();
+    }
+    return size;
+}
+
+// Tells the core we are in a spin-wait loop (frees pipeline resources for
+// the sibling hyperthread and avoids a memory-order flush on exit)
+static inline void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    asm volatile("yield");
+#endif
+}
+
 /*
  * Worker Thread logic
  */
-void TaskSystemParallelThreadPoolSleeping::workerThread() {
-    while (!killed) {
-        ReadyTask task;
-        bool hasTask = false;
-        // bool wait = false;
-
-        {   
-            // if (readyQueue.empty()) {
-            //     std::cout << "this works" << std::endl; // this is printed, which means readyQueue is not cleared
-            // }
-            // if (waitingQueue.empty()) {
-            //     std::cout << "this shouldn't be the case\n"; // this is printed, 
-            // }
-            
-            std::unique_lock<std::mutex> readyLock(readyQueueMutex);
-            if (readyQueue.empty() && (waitingQueue.empty())) {
-                // std::cout << "Wait till de\n";
-                taskAvailable.wait(readyLock); // release the lock, and let the thread sleep if the readyQueue is empty
+
+// The pool and worker index of the calling thread, set by workerMain()
+static thread_local const TaskSystemParallelThreadPoolSleeping* currentPool = nullptr;
+static thread_local int currentWorkerId = -1;
+// Set once the calling worker has retired from an elastic pool
+static thread_local bool workerRetired = false;
+
+// The launches submitted by the tasks running on the calling thread, one
+// level per task nested in another through run(), wait() or sync(). A level
+// is reused by every chunk of tasks run at that depth, so it only allocates
+// while it grows.
+struct NestedLaunches {
+    const TaskSystemParallelThreadPoolSleeping* pool;
+    std::vector<TaskID> ids;
+};
+static thread_local std::vector<NestedLaunches> nestedLaunches;
+static thread_local int nestingDepth = 0;
+
+// The tenant that launches submitted from the calling thread belong to,
+// in the pool that set it. Set around calls made through a tenant's task
+// system and while running a launch's tasks, so nested launches inherit
+// their parent's tenant.
+struct SubmitTenant {
+    const TaskSystemParallelThreadPoolSleeping* pool;
+    int tenant;
+};
+static thread_local SubmitTenant submitTenant = {nullptr, 0};
+
+class TenantScope {
+    SubmitTenant saved;
+
+    public:
+        TenantScope(const TaskSystemParallelThreadPoolSleeping* pool, int tenant) : saved(submitTenant) {
+            submitTenant = {pool, tenant};
+        }
+        ~TenantScope() {
+            submitTenant = saved;
+        }
+};
+
+// Opens a nesting level for the tasks a pool is about to run on this thread
+class NestedLaunchScope {
+    public:
+        explicit NestedLaunchScope(const TaskSystemParallelThreadPoolSleeping* pool) {
+            if ((int)nestedLaunches.size() == nestingDepth) {
+                nestedLaunches.emplace_back();
             }
-            if (readyQueue.empty()) {
-                std::unique_lock<std::mutex> waitingLock(waitingQueueMutex);
-                while (!waitingQueue.empty()) {
-                    const auto& nextTask = waitingQueue.top();
-                    if (nextTask.dependTaskID > finishedTaskID) break; // haven't finished its dependency
-                    // std::cout << "before adding tasks\n";
-                    // std::cout << "nextTask.id before readyQueue emplace is " << nextTask.id << std::endl;
-                    readyQueue.emplace(nextTask.id, nextTask.runnable, nextTask.numTotalTasks);
-                    waitingQueue.pop();
-                    // std::cout << "readyQueue.front().id afterrrrrrr emplace " << readyQueue.front().id << std::endl;
-                    // every task.id is different, so shouln't have any data race here   
-                    std::unique_lock<std::mutex> processLock(taskProcessMutex);
-                    taskProcess[nextTask.id] = {0, nextTask.numTotalTasks}; // might need a taskMutex here //nextTaskID = nextTask.id + 1
-                    taskAvailable.notify_one(); 
-                    // std::cout << "Abort happened befre waitingQueue.pop()\n";
-                    
+            nestedLaunches[nestingDepth].pool = pool;
+            nestedLaunches[nestingDepth].ids.clear();
+            ++nestingDepth;
+        }
+        ~NestedLaunchScope() {
+            --nestingDepth;
+        }
+};
+
+void TaskSystemParallelThreadPoolSleeping::workerMain(int workerId) {
+    currentPool = this;
+    currentWorkerId = workerId;
+    // Set up the outermost nesting level now rather than in the worker's
+    // first runTasks(), which may come long after the pool reached steady state
+    nestedLaunches.emplace_back();
+    startedWorkers.fetch_add(1);
+    workerThread(workerId);
+    if (workerRetired) {
+        // Detached by retireWorker(), so this is the last touch of the pool
+        // before stopWorkers() may let it be destroyed
+        retiredWorkers.fetch_sub(1);
+    }
+}
+
+void TaskSystemParallelThreadPoolSleeping::workerThread(int workerId) {
+    WorkerCounters& counters = workerCounters[workerId];
+    bool woken = false;
+    while (!killed && !workerRetired) {
+        if (replaying.load(std::memory_order_acquire)) {
+            runReplayedTask(false);
+            woken = false;
+            continue;
+        }
+        if (runReadyLaunch()) {
+            woken = false;
+            continue;
+        }
+        if (woken) {
+            counters.add(counters.spuriousWakeups, 1);
+        }
+        woken = waitForWork();
+    }
+}
+
+/*
+ * Index of the calling thread in workerCounters and taskTraces: its worker
+ * id if it is one of our workers, otherwise the entry shared by outside
+ * threads.
+ */
+int TaskSystemParallelThreadPoolSleeping::localSlot() {
+    return currentPool == this ? currentWorkerId : numThreads;
+}
+
+WorkerCounters& TaskSystemParallelThreadPoolSleeping::localCounters() {
+    return workerCounters[localSlot()];
+}
+
+/*
+ * Locks lock, charging the time to lockNanos if someone else holds it.
+ */
+void TaskSystemParallelThreadPoolSleeping::acquire(std::unique_lock<std::mutex>& lock) {
+    if (lock.try_lock()) {
+        return;
+    }
+    double startTime = CycleTimer::currentSeconds();
+    lock.lock();
+    WorkerCounters& counters = localCounters();
+    counters.addSeconds(counters.lockNanos, CycleTimer::currentSeconds() - startTime);
+}
+
+/*
+ * Takes one ticket from the ready queue and keeps claiming chunks of indices
+ * from its launch until they are all handed out. Returns false if there was
+ * no ticket. Used by the workers and by threads blocked in wait().
+ */
+bool TaskSystemParallelThreadPoolSleeping::runReadyLaunch() {
+    Launch* launch;
+    if (!readyQueue.pop(launch)) {
+        return false;
+    }
+    WorkerCounters& counters = localCounters();
+    counters.add(counters.queueDepthSamples, 1);
+    counters.add(counters.queueDepthTotal, readyQueue.sizeApprox());
+
+    int finished = 0;
+    while (runNextChunk(*launch, finished)) {}
+    completeTasks(*launch, finished);
+    releaseLaunch(*launch);
+    return true;
+}
+
+/*
+ * Claims an AdaptiveChunk-sized run of launch's task indices, runs it and
+ * adds the tasks it ran to finished. Returns false if every index had
+ * already been handed out. Callers report finished to completeTasks() once,
+ * when they stop taking chunks of the launch, so Launch::finishedTasks is
+ * written once per thread and ticket rather than once per chunk; the launch
+ * cannot finish before that anyway, as its last chunk is still running.
+ */
+bool TaskSystemParallelThreadPoolSleeping::runNextChunk(Launch& launch, int& finished) {
+    int numTotalTasks = launch.numTotalTasks;
+    int remaining = numTotalTasks - launch.nextTask.load(std::memory_order_relaxed);
+    if (remaining <= 0) {
+        return false;
+    }
+    int chunk = AdaptiveChunk::size(remaining, numThreads, launch.secondsPerTask.load(std::memory_order_relaxed));
+    int begin = launch.nextTask.fetch_add(chunk);
+    if (begin >= numTotalTasks) {
+        return false;
+    }
+
+    int end = std::min(begin + chunk, numTotalTasks);
+    unclaimedTasks.fetch_sub(end - begin, std::memory_order_relaxed);
+    finished += runTasks(launch, begin, end);
+    return true;
+}
+
+/*
+ * Returns once workAvailable() or the pool is shutting down. Spins with
+ * exponential backoff for idlePolicy.spinRounds polls first, then sleeps.
+ * Returns true if it had to sleep.
+ */
+bool TaskSystemParallelThreadPoolSleeping::waitForWork() {
+    WorkerCounters& counters = localCounters();
+    double startTime = CycleTimer::currentSeconds();
+    int pauses = 1;
+    for (int round = 0; round < idlePolicy.spinRounds; ++round) {
+        for (int i = 0; i < pauses; ++i) {
+            cpuRelax();
+        }
+        if (killed || replaying || workAvailable()) {
+            counters.add(counters.spinWakeups, 1);
+            counters.addSeconds(counters.idleNanos, CycleTimer::currentSeconds() - startTime);
+            return false;
+        }
+        pauses = std::min(pauses * 2, idlePolicy.maxPausesPerRound);
+    }
+
+    std::unique_lock<std::mutex> lock(sleepMutex, std::defer_lock);
+    acquire(lock);
+    sleepingWorkers.fetch_add(1);
+    std::atomic_thread_fence(std::memory_order_seq_cst); // pairs with the fence in wakeWorkers()
+    while (!(killed || replaying || workAvailable())) {
+        if (!elastic.enabled) {
+            taskAvailable.wait(lock);
+        } else {
+            std::chrono::duration<double> timeout(elastic.idleTimeoutSeconds);
+            if (taskAvailable.wait_for(lock, timeout) == std::cv_status::timeout) {
+                if (!(killed || replaying || workAvailable()) && retireWorker(localSlot())) {
+                    break;
                 }
+                continue;
             }
-            else {
-                // std::cout << "now readyqueue is not empty, task.currentTask is " << task.currentTask << "; totaltasks is " << task.numTotalTasks << std::endl;
-                task = readyQueue.front(); // this should be a reference pass, should not have double free error，segfault
-                if (task.currentTask >= task.numTotalTasks) { // this was readyQueue.front().currentTask >= readyQueue.front().numTotalTasks
-                    // std::cout << "now readyqueue is not empty, task.currentTask is " << task.currentTask << "; totaltasks is " << task.numTotalTasks << std::endl; // this is never printed, which means curretTask is not added 
-                    // if (readyQueue.empty()) {std::cout << "shouldn't be empty";}
-                    readyQueue.pop();  // 这里如果有些thread还在执行这个task的时候把它pop掉了可能有问题
-                }
-                else {
-                    // task.currentTask++; // this was wrong, task is a copy of readyQueue.front(), so task.currentTask++ would not affect the real task in readyQueue.
-                    // if (readyQueue.empty()) {std::cout << "shouldn't be empty";}
-                    readyQueue.front().currentTask++;
-                    // std::cout << "currentTask is " << task.currentTask << "; numtotalTasks is " << task.numTotalTasks << std::endl;
-                    // std::cout << "task change might not affect readyQueue.front().task; " << "readyQueue.front.task.currentTask is " << readyQueue.front().currentTask << std::endl;
-                    hasTask = true;
-                }
+        }
+        // Only a wakeSleepers() notify leaves a pending wakeup to take; a
+        // spurious wakeup finds none
+        if (pendingWakeups > 0) {
+            --pendingWakeups;
+            counters.add(counters.wakeups, 1);
+        }
+    }
+    sleepingWorkers.fetch_sub(1);
+    // A notify that raced with a timeout may have found no waiter to wake,
+    // but no more wakeups can be pending than there are sleepers
+    pendingWakeups = std::min(pendingWakeups, sleepingWorkers.load());
+    if (!killed) {
+        // chain-wake: one piece of work is ours, pass on what is left
+        wakeSleepers((int)std::min(readyWork(), (size_t)numThreads) - 1);
+    }
+    counters.addSeconds(counters.idleNanos, CycleTimer::currentSeconds() - startTime);
+    return true;
+}
+
+bool TaskSystemParallelThreadPoolSleeping::workAvailable() {
+    return !readyQueue.empty();
+}
+
+// Roughly how many workers could start on something right now
+size_t TaskSystemParallelThreadPoolSleeping::readyWork() {
+    return claimable(readyQueue.sizeApprox());
+}
+
+// Caps a count of queued tickets by the task indices still left to claim
+size_t TaskSystemParallelThreadPoolSleeping::claimable(size_t tickets) {
+    long long unclaimed = unclaimedTasks.load(std::memory_order_relaxed);
+    return unclaimed <= 0 ? 0 : std::min(tickets, (size_t)unclaimed);
+}
+
+// Whether runReadyLaunch() would find something for the calling thread
+bool TaskSystemParallelThreadPoolSleeping::helpAvailable() {
+    return workAvailable();
+}
+
+/*
+ * Called with launchMutex held. Registers a new launch with no deps yet.
+ */
+Launch& TaskSystemParallelThreadPoolSleeping::createLaunch(IRunnable* runnable, int num_total_tasks,
+                                                           int priority_hint) {
+    Launch& launch = launches.create(nextTaskID++, runnable, num_total_tasks);
+    launch.weight = (num_total_tasks + numThreads - 1) / numThreads + priority_hint;
+    launch.priority = launch.weight;
+    if (submitTenant.pool == this) {
+        launch.tenant = submitTenant.tenant;
+    }
+    unfinishedLaunches.fetch_add(1, std::memory_order_relaxed);
+    if (tracing.load(std::memory_order_relaxed)) {
+        launch.submitTime = CycleTimer::currentSeconds();
+    }
+    if (replaying) {
+        launch.replayed.assign(num_total_tasks, 0);
+        replayProgress++;
+    }
+    launchSubmitted(launch);
+    return launch;
+}
+
+/*
+ * Called with launchMutex held. Only deps that are still in flight need to
+ * know about launch; finished ones are either erased already or waiting for
+ * their last ticket to drop.
+ */
+void TaskSystemParallelThreadPoolSleeping::addDependency(Launch& launch, TaskID dep) {
+    Launch* depLaunch = launches.find(dep);
+    if (depLaunch && !depLaunch->done) {
+        depLaunch->successors.push_back(launch.id);
+        launch.deps.push_back(dep);
+        ++launch.pendingDeps;
+    }
+}
+
+/*
+ * Called with launchMutex held once all of launch's deps are registered.
+ * Walks up from launch and raises the priority of every ancestor that is
+ * still waiting on deps, so that it covers the chain through launch.
+ * Ancestors that are already queued keep their place. Each call visits at
+ * most maxVisits launches, so a long chain submitted one launch at a time
+ * costs O(1) per launch; the nearest ancestors, which are the ones about to
+ * become ready, get exact priorities.
+ */
+void TaskSystemParallelThreadPoolSleeping::raisePriorities(Launch& launch) {
+    const int maxVisits = 64;
+    priorityStack.clear();
+    priorityStack.push_back(&launch);
+    for (int visits = 0; !priorityStack.empty() && visits < maxVisits; ++visits) {
+        Launch* below = priorityStack.back();
+        priorityStack.pop_back();
+        for (TaskID depID : below->deps) {
+            Launch* depLaunch = launches.find(depID);
+            if (!depLaunch) {
+                continue;
             }
-            
-
-        }
-
-        if (hasTask) {
- 
-            // std::cout << "Abortion happened before runTask\n";
-            // std::cout << "Task.id is " << task.id << "; current task is" << task.currentTask << std::endl;
-            
-            task.runnable->runTask(task.currentTask, task.numTotalTasks);
-
-            // Update the most recently finished taskid--finishedTaskID
-            std::unique_lock<std::mutex> processLock(taskProcessMutex);
-            // std::unique_lock<std::mutex> waitingLock(waitingQueueMutex); // if no this mutex, 
-            // std::cout << "after runTask, befre taskProcess[task.id]\n";
-            auto& [finished, total] = taskProcess[task.id];
-            if (++finished == total) { // Task batch completed
-                taskProcess.erase(task.id);
-                finishedTaskID = std::max(finishedTaskID, task.id); // always track the most recently finished taskID so that we can check dependency 
-                // std::cout << "finishedTaskID is " << finishedTaskID << std::endl;
-                finishedCondition.notify_one();
+            Launch& dep = *depLaunch;
+            if (dep.pendingDeps > 0 && dep.weight + below->priority > dep.priority) {
+                dep.priority = dep.weight + below->priority;
+                priorityStack.push_back(&dep);
             }
         }
     }
 }
 
+/*
+ * Called with launchMutex held once pendingDeps reaches zero. Callers wake
+ * the workers once they are done making launches ready.
+ */
+void TaskSystemParallelThreadPoolSleeping::markReady(Launch& launch) {
+    if (tracing.load(std::memory_order_relaxed)) {
+        launch.readyTime = CycleTimer::currentSeconds();
+    }
+    if (launch.numTotalTasks == 0) {
+        finishLaunch(launch); // nothing to run, release the successors right away
+        return;
+    }
+    int tickets = std::min(launch.numTotalTasks, ticketsPerLaunch);
+    launch.refs.fetch_add(tickets);
+    unclaimedTasks.fetch_add(launch.numTotalTasks, std::memory_order_relaxed);
+    queueTickets(launch, tickets);
+    wakeLaunchWaiters(); // threads in helpUntil() may be the only ones not busy in a task
+    if (replaying) {
+        replayProgress++;
+        replayTurn.notify_all(); // the next task of the schedule may be one of this launch's
+    }
+}
 
-
-TaskSystemParallelThreadPoolSleeping::TaskSystemParallelThreadPoolSleeping(int num_threads)
-    : ITaskSystem(num_threads)
-{   
-   killed.store(false);
-//    finishedTaskID = -1;
-//    nextTaskID = 0;
-   threadPool.reserve(num_threads);
-   for (int i = 0; i < num_threads; ++i) {
-    threadPool.emplace_back(&TaskSystemParallelThreadPoolSleeping::workerThread, this);
-   }
+/*
+ * Called with launchMutex held. Puts tickets tickets for launch in the
+ * ready queue.
+ */
+void TaskSystemParallelThreadPoolSleeping::queueTickets(Launch& launch, int tickets) {
+    int level = PriorityLaunchQueue::levelOf(launch.priority);
+    for (int i = 0; i < tickets; ++i) {
+        readyQueue.push(&launch, level);
+    }
 }
 
-TaskSystemParallelThreadPoolSleeping::~TaskSystemParallelThreadPoolSleeping() {
+// Called with launchMutex held when a launch is created and when it finishes
+void TaskSystemParallelThreadPoolSleeping::launchSubmitted(Launch& launch) {}
+void TaskSystemParallelThreadPoolSleeping::launchCompleted(Launch& launch) {}
 
-    // std::cout << "It enteres the destructor" << std::endl;
-    killed.store(true);
-    taskAvailable.notify_all();
+/*
+ * Called with launchMutex held once the last task of a launch has finished.
+ * Releases every successor whose deps are now all done.
+ */
+void TaskSystemParallelThreadPoolSleeping::finishLaunch(Launch& launch) {
+    launch.done.store(true, std::memory_order_release);
+    if (tracing.load(std::memory_order_relaxed)) {
+        double now = CycleTimer::currentSeconds();
+        double firstStart = launch.firstStartTime.load(std::memory_order_relaxed);
+        launchTraces.push_back({launch.id, launch.numTotalTasks, launch.submitTime, launch.readyTime,
+                                firstStart > 0.0 ? firstStart : launch.readyTime, now});
+    }
+    for (TaskID successorID : launch.successors) {
+        Launch& successor = *launches.find(successorID);
+        if (--successor.pendingDeps == 0) {
+            markReady(successor);
+        }
+    }
+    if (launch.graph) {
+        const int* end = launch.graph->successorsEnd(launch.graphNode);
+        for (const int* node = launch.graph->successorsBegin(launch.graphNode); node != end; ++node) {
+            Launch& successor = *launches.find(launch.graphBase + *node);
+            if (--successor.pendingDeps == 0) {
+                markReady(successor);
+            }
+        }
+    }
 
-    // {
-    //     std::unique_lock<std::mutex> lockReady(readyQueueMutex);
-    //     std::queue<ReadyTask> emptyReadyQueue;
-    //     std::swap(readyQueue, emptyReadyQueue); // 清空 readyQueue
-    // }
-    // {
-    //     std::unique_lock<std::mutex> lockWaiting(waitingQueueMutex);
-    //     std::priority_queue<WaitingTask> emptyWaitingQueue;
-    //     std::swap(waitingQueue, emptyWaitingQueue); // 清空 waitingQueue
-    // }
+    launchCompleted(launch);
+    unfinishedLaunches.fetch_sub(1);
+    wakeLaunchWaiters();
 
-    for (auto& thread : threadPool) {
-        if (thread.joinable()) {
-            thread.join();
+    if (launch.refs.fetch_sub(1) == 1) {
+        launches.release(launch);
+    }
+}
+
+/*
+ * Runs the task indices in [begin, end) of launch, skipping those a replayed
+ * schedule already started. Returns how many it ran.
+ */
+int TaskSystemParallelThreadPoolSleeping::runTasks(Launch& launch, int begin, int end) {
+    if (launch.replayed.empty()) {
+        if (recording.load(std::memory_order_relaxed)) {
+            recordTasks(launch, begin, end);
+        }
+        runTaskRange(launch, begin, end);
+        return end - begin;
+    }
+
+    int ran = 0;
+    while (begin < end) {
+        if (launch.replayed[begin]) {
+            ++begin;
+            continue;
+        }
+        int runEnd = begin + 1;
+        while (runEnd < end && !launch.replayed[runEnd]) {
+            ++runEnd;
         }
+        if (recording.load(std::memory_order_relaxed)) {
+            recordTasks(launch, begin, runEnd);
+        }
+        runTaskRange(launch, begin, runEnd);
+        ran += runEnd - begin;
+        begin = runEnd;
     }
+    return ran;
 }
 
-void TaskSystemParallelThreadPoolSleeping::run(IRunnable* runnable, int num_total_tasks) {
-    // for (int i = 0; i < num_total_tasks; i++) {
-    //     runnable->runTask(i, num_total_tasks);
-    // }
-    std::vector<TaskID> noDeps;
-    runAsyncWithDeps(runnable, num_total_tasks, noDeps);
-    sync();  // much cleaner
-    // std::cout << "run function finished\n";
+/*
+ * Runs task indices [begin, end) of launch and folds their cost into the
+ * launch's per-task estimate.
+ */
+void TaskSystemParallelThreadPoolSleeping::runTaskRange(Launch& launch, int begin, int end) {
+    NestedLaunchScope scope(this);
+    TenantScope tenantScope(this, launch.tenant);
+    double startTime = CycleTimer::currentSeconds();
+    if (tracing.load(std::memory_order_relaxed)) {
+        runTracedTasks(launch, begin, end, startTime);
+    } else {
+        for (int i = begin; i < end; ++i) {
+            launch.runnable->runTask(i, launch.numTotalTasks);
+        }
+    }
+    double elapsed = CycleTimer::currentSeconds() - startTime;
+    WorkerCounters& counters = localCounters();
+    counters.add(counters.tasksRun, end - begin);
+    counters.addSeconds(counters.busyNanos, elapsed);
+
+    double sample = elapsed / (end - begin);
+    launch.secondsPerTask.store(AdaptiveChunk::update(launch.secondsPerTask.load(std::memory_order_relaxed), sample),
+                                std::memory_order_relaxed);
 }
 
-TaskID TaskSystemParallelThreadPoolSleeping::runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
-                                                    const std::vector<TaskID>& deps) {
-    TaskID dependency = -1;
-    if (!deps.empty()) {
-        dependency = *std::max_element(deps.begin(), deps.end()); // max_element will return an interator, *element to get the integer value
-        // std::cout << "dependency is " << dependency << std::endl; // this is not printed, which means segfault happened before this
+/*
+ * runTasks() while tracing: timestamps every index. The records are
+ * collected locally and appended afterwards, so no lock is held while the
+ * tasks run (they may submit and wait on launches of their own).
+ */
+void TaskSystemParallelThreadPoolSleeping::runTracedTasks(Launch& launch, int begin, int end, double startTime) {
+    double unset = 0.0;
+    launch.firstStartTime.compare_exchange_strong(unset, startTime, std::memory_order_relaxed);
+
+    int slot = localSlot();
+    int workerId = slot < numThreads ? slot : -1;
+    std::vector<TaskTrace> records;
+    records.reserve(end - begin);
+    double taskStart = startTime;
+    for (int i = begin; i < end; ++i) {
+        launch.runnable->runTask(i, launch.numTotalTasks);
+        double taskEnd = CycleTimer::currentSeconds();
+        records.push_back({launch.id, i, workerId, taskStart, taskEnd});
+        taskStart = taskEnd;
     }
 
-    {
-        std::unique_lock<std::mutex> lock(waitingQueueMutex);
-        std::cout << "nextTaskID is " << nextTaskID << std::endl;
-        waitingQueue.emplace(nextTaskID, dependency, runnable, num_total_tasks);
-    }                                                    
+    std::unique_lock<std::mutex> lock(traceMutex, std::defer_lock);
+    if (slot == numThreads) {
+        lock.lock();
+    }
+    std::vector<TaskTrace>& trace = taskTraces[slot];
+    trace.insert(trace.end(), records.begin(), records.end());
+}
 
-    taskAvailable.notify_all();
+/*
+ * Logs task indices [begin, end) of launch as started next by the calling
+ * thread, while recording a schedule.
+ */
+void TaskSystemParallelThreadPoolSleeping::recordTasks(Launch& launch, int begin, int end) {
+    long long seq = scheduleSeq.fetch_add(end - begin);
+    int slot = localSlot();
+    int workerId = slot < numThreads ? slot : -1;
+    std::unique_lock<std::mutex> lock(scheduleMutex, std::defer_lock);
+    if (slot == numThreads) {
+        lock.lock();
+    }
+    std::vector<RecordedTask>& records = scheduleRecords[slot];
+    for (int i = begin; i < end; ++i) {
+        records.push_back({seq++, {launch.id - scheduleBase, i, workerId}});
+    }
+}
+
+/*
+ * Replay step of the calling thread: starts the next task of the replayed
+ * schedule if it is listed with this thread and its launch is ready.
+ * Otherwise waits until the replay moves on and returns false. Since a
+ * launch only finishes while replaying when a replayed task does, that
+ * also wakes threads in helpUntil() whose wait may have ended. A thread
+ * outside the pool also wakes once no task is running, and stops the
+ * replay if it finds it stalled.
+ */
+bool TaskSystemParallelThreadPoolSleeping::runReplayedTask(bool helping) {
+    int slot = localSlot();
+    int workerId = slot < numThreads ? slot : -1;
+    bool inTask = nestingDepth > 0 && nestedLaunches[nestingDepth - 1].pool == this;
+    std::unique_lock<std::mutex> lock(launchMutex, std::defer_lock);
+    acquire(lock);
+    Launch* launch = replaying ? nextReplayedLaunch() : nullptr;
+    if (!launch || replayEntries[replayCursor].worker_id != workerId) {
+        bool watchStall = !launch && replaying && helping && !inTask;
+        if (watchStall) {
+            if (replayStalled()) {
+                stopReplay();
+            } else if (stalledAt == replayProgress) {
+                // Nothing runs that could move the replay on: look again once
+                // other threads outside the pool had a chance to submit
+                lock.unlock();
+                std::this_thread::yield();
+                return false;
+            }
+        }
+        if (replaying && !killed) {
+            double startTime = CycleTimer::currentSeconds();
+            replayBusy -= inTask;
+            if (inTask && replayBusy == 0) {
+                replayTurn.notify_all(); // for the stall check
+            }
+            long long progress = replayProgress;
+            replayTurn.wait(lock, [&]() {
+                return !replaying || killed || replayProgress != progress || (watchStall && replayBusy == 0);
+            });
+            replayBusy += inTask;
+            WorkerCounters& counters = localCounters();
+            counters.addSeconds(counters.idleNanos, CycleTimer::currentSeconds() - startTime);
+        }
+        return false;
+    }
+
+    // Claimed and logged in schedule order while still holding the lock
+    int task = replayEntries[replayCursor].task_id;
+    launch->replayed[task] = 1;
+    launch->refs.fetch_add(1); // keeps the record if the task finishes the launch
+    if (recording.load(std::memory_order_relaxed)) {
+        recordTasks(*launch, task, task + 1);
+    }
+    replayBusy++;
+    replayProgress++;
+    if (++replayCursor == replayEntries.size()) {
+        stopReplay();
+    } else {
+        replayTurn.notify_all();
+    }
+    lock.unlock();
 
-    // {
-    //     std::unique_lock<std::mutex> readyLock(readyQueueMutex);
-    //     taskAvailable.notify_all();
-    // }
-    
-    return nextTaskID++;
+    runTaskRange(*launch, task, task + 1);
+    completeTasks(*launch, 1);
+    releaseLaunch(*launch);
 
+    acquire(lock);
+    replayBusy--;
+    replayProgress++;
+    replayTurn.notify_all(); // the launch may be done, or the replay stalled
+    return true;
 }
 
-void TaskSystemParallelThreadPoolSleeping::sync() {
+/*
+ * Called with launchMutex held while replaying. Returns the launch of the
+ * next task of the schedule once it is ready to start, or nullptr while it
+ * has not been submitted or still has deps running. Stops the replay if the
+ * run no longer matches the schedule.
+ */
+Launch* TaskSystemParallelThreadPoolSleeping::nextReplayedLaunch() {
+    const ScheduleEntry& entry = replayEntries[replayCursor];
+    TaskID id = replayBase + entry.launch_id;
+    if (id >= nextTaskID) {
+        return nullptr;
+    }
+    Launch* launch = launches.find(id);
+    if (launch && launch->pendingDeps > 0) {
+        return nullptr;
+    }
+    if (!launch || launch->done || launch->replayed.empty() || entry.task_id < 0 ||
+        entry.task_id >= launch->numTotalTasks || launch->replayed[entry.task_id] ||
+        entry.worker_id < -1 || entry.worker_id >= numThreads) {
+        stopReplay();
+        return nullptr;
+    }
+    return launch;
+}
+
+/*
+ * Called with launchMutex held by a thread outside the pool that is waiting
+ * in helpUntil() while the next task of the schedule is not ready. If no
+ * task is running either, only that thread could submit what the schedule
+ * expects next, and it is blocked: the run has gone another way than the
+ * recorded one. Returns true once that has been seen twice with no progress
+ * in between; the caller yields in between, so a launch another thread
+ * outside the pool was about to submit still counts.
+ */
+bool TaskSystemParallelThreadPoolSleeping::replayStalled() {
+    if (replayBusy > 0) {
+        stalledAt = -1;
+        return false;
+    }
+    if (stalledAt == replayProgress) {
+        return true;
+    }
+    stalledAt = replayProgress;
+    return false;
+}
+
+/*
+ * Called with launchMutex held. Hands scheduling back to the ready queue,
+ * which holds the tickets of every launch that became ready meanwhile.
+ */
+void TaskSystemParallelThreadPoolSleeping::stopReplay() {
+    replaying.store(false, std::memory_order_release);
+    replayEntries.clear();
+    replayCursor = 0;
+    stalledAt = -1;
+    replayTurn.notify_all();
+}
 
-    //
-    // TODO: CS149 students will modify the implementation of this method in Part B.
-    //
-
-    std::unique_lock<std::mutex> lock(taskProcessMutex);
-    finishedCondition.wait(lock, [this]() {return finishedTaskID + 1 == nextTaskID;});
-
-    std::cout << "thread does not reach here\n"; // it does reach here
-}
-
-
-// void TaskSystemParallelThreadPoolSleeping::workerThread() {
-//     while (!killed) {
-//         ReadyTask task;
-//         bool hasTask = false;
-
-//         try {
-//             {   
-//                 std::unique_lock<std::mutex> readyLock(readyQueueMutex);
-
-//                 if (readyQueue.empty() && waitingQueue.empty()) {
-//                     taskAvailable.wait(readyLock);
-//                 }
-
-//                 // 从等待队列转移任务到就绪队列
-//                 if (readyQueue.empty()) {
-//                     std::unique_lock<std::mutex> waitingLock(waitingQueueMutex);
-//                     while (!waitingQueue.empty()) {
-//                         const auto& nextTask = waitingQueue.top();
-//                         if (nextTask.dependTaskID > finishedTaskID) break; // 依赖未完成
-//                         readyQueue.emplace(nextTask.id, nextTask.runnable, nextTask.numTotalTasks);
-//                         waitingQueue.pop();
-
-//                         // 更新任务进度
-//                         std::unique_lock<std::mutex> processLock(taskProcessMutex);
-//                         taskProcess[nextTask.id] = {0, nextTask.numTotalTasks};
-//                         taskAvailable.notify_one();
-//                     }
-//                 } else {
-//                     // 获取当前任务
-//                     task = readyQueue.front();
-//                     if (task.currentTask >= task.numTotalTasks) {
-//                         readyQueue.pop();
-//                     } else {
-//                         readyQueue.front().currentTask++;
-//                         hasTask = true;
-//                     }
-//                 }
-//             }
-
-//             if (hasTask) {
-//                 try {
-//                     // 检查任务状态是否仍然有效
-//                     if (task.currentTask >= task.numTotalTasks) {
-//                         std::cerr << "任务已完成或无效，跳过...\n";
-//                         continue;
-//                     }
-
-//                     // 执行任务
-//                     task.runnable->runTask(task.currentTask, task.numTotalTasks);
-
-//                     // 更新任务完成进度
-//                     std::unique_lock<std::mutex> processLock(taskProcessMutex);
-//                     auto& [finished, total] = taskProcess[task.id];
-//                     if (++finished == total) { // 批任务完成
-//                         taskProcess.erase(task.id);
-//                         finishedTaskID = std::max(finishedTaskID, task.id);
-//                         finishedCondition.notify_one();
-//                     }
-//                 } catch (const std::exception& e) {
-//                     std::cerr << "执行任务时发生异常: " << e.what() << "\n";
-//                 } catch (...) {
-//                     std::cerr << "执行任务时发生未知错误。\n";
-//                 }
-//             }
-//         } catch (const std::exception& e) {
-//             std::cerr << "队列或任务操作时发生异常: " << e.what() << "\n";
-//         } catch (...) {
-//             std::cerr << "队列或任务操作时发生未知错误。\n";
-//         }
-//     }
-// }
-
-// TaskSystemParallelThreadPoolSleeping::TaskSystemParallelThreadPoolSleeping(int num_threads)
-//     : ITaskSystem(num_threads)
-// {   
-//     try {
-//         killed.store(false);
-//         threadPool.reserve(num_threads);
-//         for (int i = 0; i < num_threads; ++i) {
-//             threadPool.emplace_back(&TaskSystemParallelThreadPoolSleeping::workerThread, this);
-//         }
-//     } catch (const std::exception& e) {
-//         std::cerr << "Error during initialization of TaskSystemParallelThreadPoolSleeping: " << e.what() << "\n";
-//         throw; // Rethrow if initialization fails
-//     } catch (...) {
-//         std::cerr << "Unknown error during initialization of TaskSystemParallelThreadPoolSleeping.\n";
-//         throw;
-//     }
-// }
-
-// TaskSystemParallelThreadPoolSleeping::~TaskSystemParallelThreadPoolSleeping() {
-//     try {
-//         killed.store(true);
-//         taskAvailable.notify_all();
-
-//         for (auto& thread : threadPool) {
-//             if (thread.joinable()) {
-//                 thread.join();
-//             }
-//         }
-//     } catch (const std::exception& e) {
-//         std::cerr << "Error during destruction of TaskSystemParallelThreadPoolSleeping: " << e.what() << "\n";
-//     } catch (...) {
-//         std::cerr << "Unknown error during destruction of TaskSystemParallelThreadPoolSleeping.\n";
-//     }
-// }
-
-// void TaskSystemParallelThreadPoolSleeping::run(IRunnable* runnable, int num_total_tasks) {
-//     try {
-//         std::vector<TaskID> noDeps;
-//         runAsyncWithDeps(runnable, num_total_tasks, noDeps);
-//         sync();
-//     } catch (const std::exception& e) {
-//         std::cerr << "Error during execution of run: " << e.what() << "\n";
-//     } catch (...) {
-//         std::cerr << "Unknown error during execution of run.\n";
-//     }
-// }
-
-// TaskID TaskSystemParallelThreadPoolSleeping::runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
-//                                                               const std::vector<TaskID>& deps) {
-//     try {
-//         TaskID dependency = -1;
-//         if (!deps.empty()) {
-//             dependency = *std::max_element(deps.begin(), deps.end());
-//         }
-
-//         {
-//             std::unique_lock<std::mutex> lock(waitingQueueMutex);
-//             waitingQueue.emplace(nextTaskID, dependency, runnable, num_total_tasks);
-//         }
-
-//         taskAvailable.notify_all();
-
-//         return nextTaskID++;
-//     } catch (const std::exception& e) {
-//         std::cerr << "Error during execution of runAsyncWithDeps: " << e.what() << "\n";
-//         throw; // Rethrow the exception if the task cannot be scheduled
-//     } catch (...) {
-//         std::cerr << "Unknown error during execution of runAsyncWithDeps.\n";
-//         throw;
-//     }
-// }
-
-// void TaskSystemParallelThreadPoolSleeping::sync() {
-//     try {
-//         std::unique_lock<std::mutex> lock(taskProcessMutex);
-//         finishedCondition.wait(lock, [this]() { return finishedTaskID + 1 == nextTaskID; });
-//     } catch (const std::exception& e) {
-//         std::cerr << "Error during execution of sync: " << e.what() << "\n";
-//     } catch (...) {
-//         std::cerr << "Unknown error during execution of sync.\n";
-//     }
-// }
+/*
+ * Records that count task indices of launch have finished running.
+ */
+void TaskSystemParallelThreadPoolSleeping::completeTasks(Launch& launch, int count) {
+    if (count > 0 && launch.finishedTasks.fetch_add(count) + count == launch.numTotalTasks) {
+        {
+            std::unique_lock<std::mutex> lock(launchMutex, std::defer_lock);
+            acquire(lock);
+            finishLaunch(launch);
+        }
+        wakeWorkers(); // for successors that just became ready
+    }
+}
+
+/*
+ * Drops a ticket. Called without launchMutex held.
+ */
+void TaskSystemParallelThreadPoolSleeping::releaseLaunch(Launch& launch) {
+    if (launch.refs.fetch_sub(1) == 1) {
+        std::unique_lock<std::mutex> lock(launchMutex, std::defer_lock);
+        acquire(lock);
+        launches.release(launch);
+    }
+}
+
+void TaskSystemParallelThreadPoolSleeping::wakeWorkers() {
+    // pairs with the fence in waitForWork(): either the worker sees the new
+    // tickets before it waits, or we see it counted as sleeping here
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleepingWorkers.load() > 0) {
+        std::unique_lock<std::mutex> lock(sleepMutex, std::defer_lock);
+        acquire(lock);
+        wakeSleepers((int)std::min(readyWork(), (size_t)numThreads));
+    }
+    if (elastic.enabled && activeWorkers.load(std::memory_order_relaxed) < numThreads) {
+        // more work queued than workers to take it
+        int queued = (int)std::min(readyWork(), (size_t)numThreads);
+        if (queued > activeWorkers.load(std::memory_order_relaxed)) {
+            growPool(queued);
+        }
+    }
+}
+
+/*
+ * Called with sleepMutex held. Wakes one sleeping worker per piece of work,
+ * not counting workers that have been woken but are not running yet.
+ */
+void TaskSystemParallelThreadPoolSleeping::wakeSleepers(int work) {
+    int wake = std::min(work, sleepingWorkers.load() - pendingWakeups);
+    for (int i = 0; i < wake; ++i) {
+        taskAvailable.notify_one();
+    }
+    pendingWakeups += std::max(0, wake);
+}
+
+/*
+ * Starts worker workerId in its (empty) threadPool slot. Called with
+ * sizeMutex held, or before any worker runs.
+ */
+void TaskSystemParallelThreadPoolSleeping::startWorker(int workerId) {
+    workerActive[workerId] = 1;
+    activeWorkers.fetch_add(1);
+    threadPool[workerId] = std::thread(&TaskSystemParallelThreadPoolSleeping::workerMain, this, workerId);
+    if (!workerCpus.empty()) {
+        PlacementPolicy::pinWorker(threadPool[workerId], workerId, workerCpus[workerId].cpu);
+    }
+}
+
+/*
+ * Starts workers in free slots until target (at most numThreads) are running.
+ */
+void TaskSystemParallelThreadPoolSleeping::growPool(int target) {
+    std::lock_guard<std::mutex> lock(sizeMutex);
+    if (killed || activeWorkers.load() >= target) {
+        return;
+    }
+    for (int slot = 0; slot < numThreads && activeWorkers.load() < target; ++slot) {
+        if (workerActive[slot]) {
+            continue;
+        }
+        startWorker(slot); // a retired worker detached itself from the slot
+    }
+    recordPoolSize(true);
+}
+
+/*
+ * Called by an idle worker whose sleep timed out. Returns true if it should
+ * exit, i.e. the pool is still above its minimum size.
+ */
+bool TaskSystemParallelThreadPoolSleeping::retireWorker(int workerId) {
+    std::lock_guard<std::mutex> lock(sizeMutex);
+    if (activeWorkers.load() <= elastic.minThreads) {
+        return false;
+    }
+    workerActive[workerId] = 0;
+    activeWorkers.fetch_sub(1);
+    // Nobody joins a retired worker: growPool() can run on a worker's
+    // completion path and must not block on another thread's exit
+    threadPool[workerId].detach();
+    retiredWorkers.fetch_add(1);
+    workerRetired = true;
+    recordPoolSize(false);
+    return true;
+}
+
+/*
+ * Called with sizeMutex held.
+ */
+void TaskSystemParallelThreadPoolSleeping::recordPoolSize(bool grew) {
+    sizeEvents.push_back({CycleTimer::currentSeconds(), activeWorkers.load(), grew,
+                          (long long)readyQueue.sizeApprox()});
+}
+
+TaskSystemParallelThreadPoolSleeping::TaskSystemParallelThreadPoolSleeping(int num_threads,
+                                                                           const PlacementPolicy& placement,
+                                                                           const IdlePolicy& idle,
+                                                                           const ElasticPolicy& elastic)
+    : TaskSystemParallelThreadPoolSleeping(num_threads, num_threads, placement, idle, elastic)
+{   
+    startWorkers();
+}
+
+TaskSystemParallelThreadPoolSleeping::TaskSystemParallelThreadPoolSleeping(int num_threads, int tickets_per_launch,
+                                                                           const PlacementPolicy& placement,
+                                                                           const IdlePolicy& idle,
+                                                                           const ElasticPolicy& elastic)
+    : ITaskSystem(num_threads), numThreads(num_threads), ticketsPerLaunch(tickets_per_launch), launches(256), readyQueue(256),
+      workerCpus(placement.assign(num_threads)), idlePolicy(idle), elastic(elastic), workerActive(num_threads, 0),
+      workerCounters(num_threads + 1), taskTraces(num_threads + 1), scheduleRecords(num_threads + 1)
+{
+    killed.store(false);
+}
+
+TaskSystemParallelThreadPoolSleeping::~TaskSystemParallelThreadPoolSleeping() {
+    stopWorkers();
+}
+
+void TaskSystemParallelThreadPoolSleeping::startWorkers() {
+    threadPool.resize(numThreads);
+    int initial = elastic.enabled ? std::max(1, std::min(elastic.minThreads, numThreads)) : numThreads;
+    elastic.minThreads = initial;
+    {
+        std::lock_guard<std::mutex> lock(sizeMutex);
+        for (int i = 0; i < initial; ++i) {
+            startWorker(i);
+        }
+    }
+    // Return with every worker set up, so what a thread allocates on its way
+    // in is not charged to the first launches
+    while (startedWorkers.load() < initial) {
+        std::this_thread::yield();
+    }
+}
+
+void TaskSystemParallelThreadPoolSleeping::stopWorkers() {
+    {
+        // growPool() checks killed under sizeMutex, so once this is set no
+        // worker touches threadPool any more and it can be joined unlocked
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        std::lock_guard<std::mutex> sizeLock(sizeMutex);
+        killed.store(true);
+        taskAvailable.notify_all();
+    }
+    {
+        std::lock_guard<std::mutex> lock(launchMutex);
+        replayTurn.notify_all();
+    }
+
+    for (auto& thread : threadPool) {
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+    // Retired workers were detached; wait until they are out of workerMain()
+    while (retiredWorkers.load() > 0) {
+        std::this_thread::yield();
+    }
+}
+
+/*
+ * runAsyncWithDeps() and wait() in one: the launch is pinned in the same
+ * critical section that creates it.
+ */
+void TaskSystemParallelThreadPoolSleeping::run(IRunnable* runnable, int num_total_tasks) {
+    Launch* launch;
+    {
+        std::unique_lock<std::mutex> lock(launchMutex, std::defer_lock);
+        acquire(lock);
+        launch = &createLaunch(runnable, num_total_tasks);
+        recordNestedLaunch(launch->id);
+        launch->refs.fetch_add(1);
+        markReady(*launch);
+    }
+    wakeWorkers();
+    helpUntil([launch]() {return launch->done.load(std::memory_order_acquire);});
+    releaseLaunch(*launch);
+}
+
+TaskID TaskSystemParallelThreadPoolSleeping::runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
+                                                    const std::vector<TaskID>& deps) {
+    TaskID id;
+    {
+        std::unique_lock<std::mutex> lock(launchMutex, std::defer_lock);
+        acquire(lock);
+        Launch& launch = createLaunch(runnable, num_total_tasks);
+        id = launch.id;
+        recordNestedLaunch(id);
+        for (TaskID dep : deps) {
+            addDependency(launch, dep);
+        }
+        raisePriorities(launch);
+        if (launch.pendingDeps == 0) {
+            markReady(launch);
+        }
+    }
+    wakeWorkers();
+    return id;
+}
+
+/*
+ * Registers the whole batch under a single acquisition of launchMutex and
+ * wakes the workers once at the end, instead of once per launch. Launches
+ * with nothing to wait for are only queued once the whole batch is in, so
+ * their priorities already cover every chain in the batch.
+ */
+void TaskSystemParallelThreadPoolSleeping::runAsyncBatchWithDeps(const std::vector<BulkLaunch>& batch,
+                                                                 std::vector<TaskID>& task_ids) {
+    task_ids.resize(batch.size());
+    {
+        std::unique_lock<std::mutex> lock(launchMutex, std::defer_lock);
+        acquire(lock);
+        batchRoots.clear();
+        for (size_t i = 0; i < batch.size(); ++i) {
+            Launch& launch = createLaunch(batch[i].runnable, batch[i].num_total_tasks, batch[i].priority);
+            task_ids[i] = launch.id;
+            recordNestedLaunch(launch.id);
+            for (TaskID dep : batch[i].deps) {
+                addDependency(launch, dep);
+            }
+            for (int idx : batch[i].batch_deps) {
+                addDependency(launch, task_ids[idx]);
+            }
+            if (launch.pendingDeps == 0) {
+                ++launch.pendingDeps; // hold it back until the batch is in
+                batchRoots.push_back(&launch);
+            }
+            raisePriorities(launch);
+        }
+        for (Launch* root : batchRoots) {
+            root->pendingDeps = 0;
+            markReady(*root);
+        }
+    }
+    wakeWorkers();
+}
+
+/*
+ * Replays graph under a single acquisition of launchMutex. The TaskIDs are
+ * consecutive, so launches keep pointing into the graph's successor lists
+ * instead of copying them, and pendingDeps starts at the precomputed
+ * in-degree. Priorities come from one reverse pass over the graph, which is
+ * in topological order. Only the roots go through addDependency(), for
+ * the external deps.
+ */
+void TaskSystemParallelThreadPoolSleeping::runGraphAsync(const TaskGraph& graph,
+                                                         const std::vector<IRunnable*>& runnables,
+                                                         const std::vector<TaskID>& deps,
+                                                         std::vector<TaskID>& task_ids) {
+    int size = graph.size();
+    task_ids.resize(size);
+    {
+        std::unique_lock<std::mutex> lock(launchMutex, std::defer_lock);
+        acquire(lock);
+        graphLaunches.resize(size);
+        TaskID base = nextTaskID;
+        for (int node = 0; node < size; ++node) {
+            IRunnable* runnable = node < (int)runnables.size() && runnables[node] ? runnables[node]
+                                                                                  : graph.runnable(node);
+            Launch& launch = createLaunch(runnable, graph.numTotalTasks(node));
+            launch.graph = &graph;
+            launch.graphNode = node;
+            launch.graphBase = base;
+            launch.pendingDeps = graph.inDegree(node);
+            task_ids[node] = launch.id;
+            recordNestedLaunch(launch.id);
+            graphLaunches[node] = &launch;
+        }
+
+        for (int node = size - 1; node >= 0; --node) {
+            Launch& launch = *graphLaunches[node];
+            for (const int* succ = graph.successorsBegin(node); succ != graph.successorsEnd(node); ++succ) {
+                launch.priority = std::max(launch.priority, launch.weight + graphLaunches[*succ]->priority);
+            }
+        }
+
+        batchRoots.clear();
+        for (int root : graph.roots()) {
+            Launch& launch = *graphLaunches[root];
+            for (TaskID dep : deps) {
+                addDependency(launch, dep);
+            }
+            raisePriorities(launch);
+            if (launch.pendingDeps == 0) {
+                batchRoots.push_back(&launch);
+            }
+        }
+        for (Launch* root : batchRoots) {
+            markReady(*root);
+        }
+    }
+    wakeWorkers();
+}
+
+/*
+ * Returns once finished() holds; it is called without launchMutex held.
+ * Meanwhile the calling thread runs ready work, and once there is none it
+ * parks on finishedEpoch until a launch finishes or becomes ready. Waking
+ * needs no lock, so the last finisher of a launch hands nothing over to the
+ * waiter but the epoch bump.
+ */
+template <typename Predicate>
+void TaskSystemParallelThreadPoolSleeping::helpUntil(Predicate finished) {
+    while (!finished()) {
+        if (replaying.load(std::memory_order_acquire)) {
+            runReplayedTask(true);
+            continue;
+        }
+        if (runReadyLaunch()) {
+            continue;
+        }
+        launchWaiters.fetch_add(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst); // pairs with the fence in wakeLaunchWaiters()
+        unsigned epoch = finishedEpoch.load();
+        if (!finished() && !helpAvailable()) {
+            double startTime = CycleTimer::currentSeconds();
+            finishedEpoch.wait(epoch);
+            WorkerCounters& counters = localCounters();
+            counters.addSeconds(counters.idleNanos, CycleTimer::currentSeconds() - startTime);
+        }
+        launchWaiters.fetch_sub(1);
+    }
+}
+
+/*
+ * Called after publishing a finished or newly ready launch. Either a thread
+ * about to park in helpUntil() sees what was published, or it is counted in
+ * launchWaiters here and the epoch bump keeps it from sleeping.
+ */
+void TaskSystemParallelThreadPoolSleeping::wakeLaunchWaiters() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (launchWaiters.load(std::memory_order_relaxed) > 0) {
+        finishedEpoch.fetch_add(1);
+        finishedEpoch.notify_all();
+    }
+}
+
+void TaskSystemParallelThreadPoolSleeping::sync() {
+    if (syncNested()) {
+        return;
+    }
+    helpUntil([this]() {return unfinishedLaunches.load() == 0;});
+}
+
+/*
+ * Remembers a launch submitted from inside one of this pool's tasks, for
+ * syncNested().
+ */
+void TaskSystemParallelThreadPoolSleeping::recordNestedLaunch(TaskID id) {
+    if (nestingDepth > 0 && nestedLaunches[nestingDepth - 1].pool == this) {
+        nestedLaunches[nestingDepth - 1].ids.push_back(id);
+    }
+}
+
+/*
+ * sync() from inside one of this pool's tasks: waiting for every launch
+ * would include the one running the caller, so only the launches the
+ * calling task submitted are waited for. Returns false if the caller is not
+ * running one of our tasks.
+ */
+bool TaskSystemParallelThreadPoolSleeping::syncNested() {
+    int depth = nestingDepth - 1;
+    if (depth < 0 || nestedLaunches[depth].pool != this) {
+        return false;
+    }
+    size_t next = 0;
+    helpUntil([&]() {
+        // helping runs deeper tasks, which may reallocate nestedLaunches
+        const std::vector<TaskID>& ids = nestedLaunches[depth].ids;
+        while (next < ids.size() && launchFinishedLocked(ids[next])) {
+            ++next;
+        }
+        return next == ids.size();
+    });
+    nestedLaunches[depth].ids.clear();
+    return true;
+}
+
+/*
+ * Called with launchMutex held.
+ */
+bool TaskSystemParallelThreadPoolSleeping::launchFinished(TaskID id) {
+    if (id < 0 || id >= nextTaskID) {
+        return true;
+    }
+    Launch* launch = launches.find(id);
+    return !launch || launch->done;
+}
+
+bool TaskSystemParallelThreadPoolSleeping::launchFinishedLocked(TaskID id) {
+    std::unique_lock<std::mutex> lock(launchMutex, std::defer_lock);
+    acquire(lock);
+    return launchFinished(id);
+}
+
+/*
+ * Takes a reference on the launch so its record is not recycled while the
+ * caller watches its done flag. Returns nullptr if it has already finished.
+ * The caller drops the reference with releaseLaunch().
+ */
+Launch* TaskSystemParallelThreadPoolSleeping::pinLaunch(TaskID id) {
+    std::unique_lock<std::mutex> lock(launchMutex, std::defer_lock);
+    acquire(lock);
+    if (launchFinished(id)) {
+        return nullptr;
+    }
+    Launch* launch = launches.find(id);
+    launch->refs.fetch_add(1);
+    return launch;
+}
+
+void TaskSystemParallelThreadPoolSleeping::wait(TaskID task_id) {
+    Launch* launch = pinLaunch(task_id);
+    if (!launch) {
+        return;
+    }
+    helpUntil([launch]() {return launch->done.load(std::memory_order_acquire);});
+    releaseLaunch(*launch);
+}
+
+TaskID TaskSystemParallelThreadPoolSleeping::waitAny(const std::vector<TaskID>& task_ids) {
+    if (task_ids.empty()) {
+        return -1;
+    }
+
+    TaskID finishedID = -1;
+    helpUntil([&]() {
+        std::unique_lock<std::mutex> lock(launchMutex, std::defer_lock);
+        acquire(lock);
+        for (TaskID id : task_ids) {
+            if (launchFinished(id)) {
+                finishedID = id;
+                return true;
+            }
+        }
+        return false;
+    });
+    return finishedID;
+}
+
+void TaskSystemParallelThreadPoolSleeping::workerStats(std::vector<WorkerStats>& stats) {
+    stats.clear();
+    for (int i = 0; i <= numThreads; ++i) {
+        WorkerCounters& counters = workerCounters[i];
+        WorkerStats entry;
+        entry.worker_id = i < numThreads ? i : -1;
+        entry.tasks_run = counters.tasksRun.load(std::memory_order_relaxed);
+        entry.busy_seconds = counters.busyNanos.load(std::memory_order_relaxed) * 1e-9;
+        entry.idle_seconds = counters.idleNanos.load(std::memory_order_relaxed) * 1e-9;
+        entry.lock_seconds = counters.lockNanos.load(std::memory_order_relaxed) * 1e-9;
+        entry.spin_wakeups = counters.spinWakeups.load(std::memory_order_relaxed);
+        entry.wakeups = counters.wakeups.load(std::memory_order_relaxed);
+        entry.spurious_wakeups = counters.spuriousWakeups.load(std::memory_order_relaxed);
+        entry.queue_depth_samples = counters.queueDepthSamples.load(std::memory_order_relaxed);
+        entry.mean_queue_depth = entry.queue_depth_samples == 0 ? 0.0 :
+            (double)counters.queueDepthTotal.load(std::memory_order_relaxed) / entry.queue_depth_samples;
+        stats.push_back(entry);
+    }
+}
+
+/*
+ * Only call while no launches are in flight: workers append to their trace
+ * buffers without a lock.
+ */
+void TaskSystemParallelThreadPoolSleeping::setTracing(bool enabled) {
+    std::lock_guard<std::mutex> launchLock(launchMutex);
+    std::lock_guard<std::mutex> traceLock(traceMutex);
+    if (enabled) {
+        launchTraces.clear();
+        for (auto& trace : taskTraces) {
+            trace.clear();
+        }
+    }
+    tracing.store(enabled);
+}
+
+void TaskSystemParallelThreadPoolSleeping::traceEvents(std::vector<LaunchTrace>& launches,
+                                                       std::vector<TaskTrace>& tasks) {
+    std::lock_guard<std::mutex> launchLock(launchMutex);
+    std::lock_guard<std::mutex> traceLock(traceMutex);
+    launches = launchTraces;
+    tasks.clear();
+    for (const auto& trace : taskTraces) {
+        tasks.insert(tasks.end(), trace.begin(), trace.end());
+    }
+}
+
+void TaskSystemParallelThreadPoolSleeping::poolSizeEvents(std::vector<PoolSizeEvent>& events) {
+    std::lock_guard<std::mutex> lock(sizeMutex);
+    events = sizeEvents;
+}
+
+void TaskSystemParallelThreadPoolSleeping::setScheduleRecording(bool enabled) {
+    std::lock_guard<std::mutex> launchLock(launchMutex);
+    std::lock_guard<std::mutex> scheduleLock(scheduleMutex);
+    if (enabled) {
+        for (auto& records : scheduleRecords) {
+            records.clear();
+        }
+        scheduleSeq.store(0);
+        scheduleBase = nextTaskID;
+    }
+    recording.store(enabled);
+}
+
+void TaskSystemParallelThreadPoolSleeping::recordedSchedule(std::vector<ScheduleEntry>& schedule) {
+    std::vector<RecordedTask> merged;
+    {
+        std::lock_guard<std::mutex> lock(scheduleMutex);
+        for (const auto& records : scheduleRecords) {
+            merged.insert(merged.end(), records.begin(), records.end());
+        }
+    }
+    std::sort(merged.begin(), merged.end(),
+              [](const RecordedTask& a, const RecordedTask& b) { return a.seq < b.seq; });
+    schedule.clear();
+    for (const RecordedTask& task : merged) {
+        schedule.push_back(task.entry);
+    }
+}
+
+void TaskSystemParallelThreadPoolSleeping::replaySchedule(const std::vector<ScheduleEntry>& schedule) {
+    if (elastic.enabled) {
+        growPool(numThreads); // every worker the schedule lists has to be there
+    }
+    {
+        std::lock_guard<std::mutex> lock(launchMutex);
+        replayEntries = schedule;
+        replayCursor = 0;
+        replayProgress = 0;
+        stalledAt = -1;
+        replayBase = nextTaskID;
+        replaying.store(!schedule.empty(), std::memory_order_release);
+    }
+    // sleeping workers take their turns from the schedule from now on
+    std::lock_guard<std::mutex> lock(sleepMutex);
+    taskAvailable.notify_all();
+}
+
+/*
+ * ================================================================
+ * Work Stealing Task System Implementation
+ * ================================================================
+ */
+
+/*
+ * RangeDeque implementation, following Le et al., "Correct and Efficient
+ * Work-Stealing for Weak Memory Models" (PPoPP'13)
+ */
+RangeDeque::RangeDeque(size_t capacity)
+    : slots(new Slot[capacity]), mask(capacity - 1) {}
+
+bool RangeDeque::push(const TaskRange& range) {
+    int64_t b = bottom.load(std::memory_order_relaxed);
+    int64_t t = top.load(std::memory_order_acquire);
+    if (b - t > mask) {
+        return false;
+    }
+    Slot& slot = slots[b & mask];
+    slot.launch.store(range.launch, std::memory_order_relaxed);
+    slot.begin.store(range.begin, std::memory_order_relaxed);
+    slot.end.store(range.end, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom.store(b + 1, std::memory_order_relaxed);
+    return true;
+}
+
+bool RangeDeque::pop(TaskRange& range) {
+    int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+    bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = top.load(std::memory_order_relaxed);
+    if (t > b) {
+        bottom.store(b + 1, std::memory_order_relaxed); // was empty
+        return false;
+    }
+
+    Slot& slot = slots[b & mask];
+    range.launch = slot.launch.load(std::memory_order_relaxed);
+    range.begin = slot.begin.load(std::memory_order_relaxed);
+    range.end = slot.end.load(std::memory_order_relaxed);
+    if (t == b) {
+        // last entry, race thieves for it
+        bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                               std::memory_order_relaxed);
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return won;
+    }
+    return true;
+}
+
+bool RangeDeque::steal(TaskRange& range) {
+    int64_t t = top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = bottom.load(std::memory_order_acquire);
+    if (t >= b) {
+        return false;
+    }
+
+    Slot& slot = slots[t & mask];
+    range.launch = slot.launch.load(std::memory_order_relaxed);
+    range.begin = slot.begin.load(std::memory_order_relaxed);
+    range.end = slot.end.load(std::memory_order_relaxed);
+    return top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                       std::memory_order_relaxed);
+}
+
+bool RangeDeque::empty() const {
+    return bottom.load() <= top.load();
+}
+
+const char* TaskSystemWorkStealing::name() {
+    return "Parallel + Work Stealing";
+}
+
+TaskSystemWorkStealing::TaskSystemWorkStealing(int num_threads, const PlacementPolicy& placement,
+                                               const IdlePolicy& idle)
+    : TaskSystemParallelThreadPoolSleeping(num_threads, 1, placement, idle, ElasticPolicy()) // the worker taking a launch splits it, one ticket is enough
+{
+    deques.reserve(num_threads);
+    for (int i = 0; i < num_threads; ++i) {
+        deques.emplace_back(new RangeDeque(64)); // lazy splitting keeps at most ~1 entry per launch in flight
+    }
+
+    // Every thief walks the other workers cyclically starting after itself,
+    // with same-complex workers moved to the front. Unpinned workers all
+    // count as one complex.
+    victimOrder.resize(num_threads + 1);
+    for (int thief = 0; thief < num_threads; ++thief) {
+        int complex = workerCpus.empty() ? 0 : workerCpus[thief].complex;
+        std::vector<int>& order = victimOrder[thief];
+        for (int i = 1; i < num_threads; ++i) {
+            order.push_back((thief + i) % num_threads);
+        }
+        std::stable_partition(order.begin(), order.end(), [&](int victim) {
+            return workerCpus.empty() || workerCpus[victim].complex == complex;
+        });
+    }
+    for (int i = 0; i < num_threads; ++i) {
+        victimOrder[num_threads].push_back(i);
+    }
+
+    startWorkers();
+}
+
+TaskSystemWorkStealing::~TaskSystemWorkStealing() {
+    stopWorkers(); // workers touch deques, stop them before the deques go away
+}
+
+void TaskSystemWorkStealing::workerThread(int workerId) {
+    WorkerCounters& counters = workerCounters[workerId];
+    bool woken = false;
+    while (!killed) {
+        if (replaying.load(std::memory_order_acquire)) {
+            runReplayedTask(false);
+            woken = false;
+            continue;
+        }
+        if (runWorkerStep(workerId)) {
+            woken = false;
+            continue;
+        }
+        if (woken) {
+            counters.add(counters.spuriousWakeups, 1);
+        }
+        woken = waitForWork();
+    }
+}
+
+/*
+ * Runs one piece of work as worker workerId: a range from its own deque, a
+ * stolen one, or a new ready launch. Returns false if there was none.
+ */
+bool TaskSystemWorkStealing::runWorkerStep(int workerId) {
+    TaskRange range;
+    if (deques[workerId]->pop(range) || stealRange(workerId, range)) {
+        runRange(workerId, range);
+        return true;
+    }
+
+    Launch* launch;
+    if (readyQueue.pop(launch)) {
+        WorkerCounters& counters = workerCounters[workerId];
+        counters.add(counters.queueDepthSamples, 1);
+        counters.add(counters.queueDepthTotal, readyQueue.sizeApprox());
+
+        // claim everything this ticket covers as one range and split it from there
+        int numTotalTasks = launch->numTotalTasks;
+        int begin = launch->nextTask.fetch_add(numTotalTasks);
+        if (begin < numTotalTasks) {
+            unclaimedTasks.fetch_sub(numTotalTasks - begin, std::memory_order_relaxed);
+            runRange(workerId, {launch, begin, numTotalTasks});
+        }
+        releaseLaunch(*launch);
+        return true;
+    }
+    return false;
+}
+
+/*
+ * Runs range in AdaptiveChunk-sized steps. Whenever this worker's deque is
+ * empty the upper half of what is left is pushed there, so idle workers always
+ * have something to steal without the range being split any further than
+ * needed.
+ */
+void TaskSystemWorkStealing::runRange(int workerId, TaskRange range) {
+    RangeDeque& deque = *deques[workerId];
+    Launch& launch = *range.launch;
+
+    int finished = 0;
+    while (range.begin < range.end) {
+        if (range.end - range.begin > 1 && deque.empty()) {
+            int mid = range.begin + (range.end - range.begin + 1) / 2;
+            if (deque.push({range.launch, mid, range.end})) {
+                range.end = mid;
+                wakeWorkers();
+            }
+        }
+        int chunk = AdaptiveChunk::size(range.end - range.begin, numThreads,
+                                        launch.secondsPerTask.load(std::memory_order_relaxed));
+        int begin = range.begin;
+        range.begin += chunk;
+        finished += runTasks(launch, begin, range.begin);
+    }
+    // may free launch once the last index of the whole launch is done
+    completeTasks(launch, finished);
+}
+
+/*
+ * Tries each victim in victimOrder once. Threads outside the pool pass -1.
+ */
+bool TaskSystemWorkStealing::stealRange(int thief, TaskRange& range) {
+    for (int victim : victimOrder[thief < 0 ? numThreads : thief]) {
+        if (deques[victim]->steal(range)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Helping path for threads blocked in wait(). A worker waiting on a launch
+ * submitted by one of its tasks helps exactly as it would from its loop, so
+ * nested launches still get picked up when every worker is waiting on one.
+ * Threads outside the pool have no deque to split into, so they only steal
+ * ranges and run them to completion.
+ */
+bool TaskSystemWorkStealing::runReadyLaunch() {
+    int slot = localSlot();
+    if (slot < numThreads) {
+        return runWorkerStep(slot);
+    }
+
+    TaskRange range;
+    if (!stealRange(-1, range)) {
+        return false;
+    }
+
+    Launch& launch = *range.launch;
+    int finished = 0;
+    while (range.begin < range.end) {
+        int chunk = AdaptiveChunk::size(range.end - range.begin, numThreads,
+                                        launch.secondsPerTask.load(std::memory_order_relaxed));
+        int begin = range.begin;
+        range.begin += chunk;
+        finished += runTasks(launch, begin, range.begin);
+    }
+    completeTasks(launch, finished);
+    return true;
+}
+
+size_t TaskSystemWorkStealing::readyWork() {
+    size_t work = claimable(readyQueue.sizeApprox());
+    for (auto& deque : deques) {
+        work += !deque->empty();
+    }
+    return work;
+}
+
+bool TaskSystemWorkStealing::workAvailable() {
+    if (!readyQueue.empty()) {
+        return true;
+    }
+    for (auto& deque : deques) {
+        if (!deque->empty()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Threads outside the pool only steal, a launch still in the ready queue is
+// no use to them
+bool TaskSystemWorkStealing::helpAvailable() {
+    if (localSlot() < numThreads) {
+        return workAvailable();
+    }
+    for (auto& deque : deques) {
+        if (!deque->empty()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * ================================================================
+ * Fair Share Task System Implementation
+ * ================================================================
+ */
+
+const char* TaskSystemFairShare::name() {
+    return "Parallel + Fair Share";
+}
+
+TaskSystemFairShare::TaskSystemFairShare(int num_threads, const PlacementPolicy& placement,
+                                         const IdlePolicy& idle, int max_tenants)
+    : TaskSystemParallelThreadPoolSleeping(num_threads, num_threads, placement, idle, ElasticPolicy())
+{
+    tenants.reserve(std::max(1, max_tenants));
+    for (int i = 0; i < std::max(1, max_tenants); ++i) {
+        tenants.emplace_back(new Tenant());
+    }
+    startWorkers();
+}
+
+TaskSystemFairShare::~TaskSystemFairShare() {
+    stopWorkers(); // workers scan tenants, stop them before the tenants go away
+}
+
+ITaskSystem* TaskSystemFairShare::tenant(int weight) {
+    std::lock_guard<std::mutex> lock(tenantMutex);
+    int id = numTenants.load();
+    if (id == (int)tenants.size()) {
+        return nullptr;
+    }
+    Tenant& tenant = *tenants[id];
+    tenant.weight = std::max(1, weight);
+    tenant.virtualTime.store(std::max(0.0, leastActiveTime(&tenant)));
+    tenant.view.reset(new TenantView(this, id));
+    numTenants.store(id + 1, std::memory_order_release);
+    return tenant.view.get();
+}
+
+/*
+ * The least virtual time among tenants other than except that have
+ * unfinished launches, or -1 if there are none.
+ */
+double TaskSystemFairShare::leastActiveTime(const Tenant* except) {
+    double least = -1.0;
+    int count = numTenants.load(std::memory_order_acquire);
+    for (int i = 0; i < count; ++i) {
+        Tenant& other = *tenants[i];
+        if (&other == except || other.unfinished.load(std::memory_order_relaxed) == 0) {
+            continue;
+        }
+        double time = other.virtualTime.load(std::memory_order_relaxed);
+        if (least < 0.0 || time < least) {
+            least = time;
+        }
+    }
+    return least;
+}
+
+/*
+ * The tenant whose work the calling thread may help with: a thread outside
+ * the pool waiting through a tenant's task system only runs that tenant's
+ * tasks, so it is not held up by another tenant's chunk. -1 for any.
+ */
+int TaskSystemFairShare::helpTenant() {
+    return localSlot() == numThreads && submitTenant.pool == this ? submitTenant.tenant : -1;
+}
+
+// The tenant with ready work that has had the least worker time per weight
+TaskSystemFairShare::Tenant* TaskSystemFairShare::nextTenant() {
+    Tenant* best = nullptr;
+    double bestTime = 0.0;
+    int count = numTenants.load(std::memory_order_acquire);
+    for (int i = 0; i < count; ++i) {
+        Tenant* tenant = tenants[i].get();
+        if (tenant->ready.empty()) {
+            continue;
+        }
+        double time = tenant->virtualTime.load(std::memory_order_relaxed);
+        if (!best || time < bestTime) {
+            best = tenant;
+            bestTime = time;
+        }
+    }
+    return best;
+}
+
+void TaskSystemFairShare::charge(Tenant& tenant, double seconds) {
+    tenant.virtualTime.fetch_add(seconds / tenant.weight, std::memory_order_relaxed);
+    tenant.busyNanos.fetch_add(static_cast<long long>(seconds * 1e9), std::memory_order_relaxed);
+}
+
+/*
+ * Takes a ticket from nextTenant() (or helpTenant()) and runs chunks of its
+ * launch, handing the ticket back as soon as another tenant with ready work
+ * has had less worker time per weight.
+ */
+bool TaskSystemFairShare::runReadyLaunch() {
+    int only = helpTenant();
+    Tenant* tenant = only < 0 ? nextTenant() : tenants[only].get();
+    Launch* launch;
+    if (!tenant || !tenant->ready.pop(launch)) {
+        return false;
+    }
+    WorkerCounters& counters = localCounters();
+    counters.add(counters.queueDepthSamples, 1);
+    counters.add(counters.queueDepthTotal, tenant->ready.sizeApprox());
+
+    int finished = 0;
+    while (true) {
+        double startTime = CycleTimer::currentSeconds();
+        if (!runNextChunk(*launch, finished)) {
+            break;
+        }
+        charge(*tenant, CycleTimer::currentSeconds() - startTime);
+
+        if (only >= 0) {
+            continue;
+        }
+        Tenant* next = nextTenant();
+        if (next && next != tenant &&
+            next->virtualTime.load(std::memory_order_relaxed) < tenant->virtualTime.load(std::memory_order_relaxed)) {
+            completeTasks(*launch, finished); // before the ticket, and with it the record, is handed back
+            tenant->ready.push(launch, PriorityLaunchQueue::levelOf(launch->priority));
+            return true;
+        }
+    }
+    completeTasks(*launch, finished);
+    releaseLaunch(*launch);
+    return true;
+}
+
+bool TaskSystemFairShare::helpAvailable() {
+    int only = helpTenant();
+    return only < 0 ? workAvailable() : !tenants[only]->ready.empty();
+}
+
+size_t TaskSystemFairShare::readyWork() {
+    size_t work = 0;
+    int count = numTenants.load(std::memory_order_acquire);
+    for (int i = 0; i < count; ++i) {
+        work += tenants[i]->ready.sizeApprox();
+    }
+    return claimable(work);
+}
+
+bool TaskSystemFairShare::workAvailable() {
+    int count = numTenants.load(std::memory_order_acquire);
+    for (int i = 0; i < count; ++i) {
+        if (!tenants[i]->ready.empty()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Called with launchMutex held. A tenant with nothing queued is brought
+ * level with the least-served active tenant before its tickets go in.
+ */
+void TaskSystemFairShare::queueTickets(Launch& launch, int tickets) {
+    Tenant& tenant = *tenants[launch.tenant];
+    if (tenant.ready.empty()) {
+        double floor = leastActiveTime(&tenant);
+        double time = tenant.virtualTime.load(std::memory_order_relaxed);
+        while (time < floor && !tenant.virtualTime.compare_exchange_weak(time, floor)) {}
+    }
+    int level = PriorityLaunchQueue::levelOf(launch.priority);
+    for (int i = 0; i < tickets; ++i) {
+        tenant.ready.push(&launch, level);
+    }
+}
+
+void TaskSystemFairShare::launchSubmitted(Launch& launch) {
+    tenants[launch.tenant]->unfinished.fetch_add(1, std::memory_order_relaxed);
+    launch.submitTime = CycleTimer::currentSeconds();
+}
+
+void TaskSystemFairShare::launchCompleted(Launch& launch) {
+    Tenant& tenant = *tenants[launch.tenant];
+    double latency = CycleTimer::currentSeconds() - launch.submitTime;
+    ++tenant.launches;
+    tenant.totalLatency += latency;
+    tenant.maxLatency = std::max(tenant.maxLatency, latency);
+    tenant.unfinished.fetch_sub(1); // before finishLaunch() wakes the waiters
+}
+
+void TaskSystemFairShare::syncTenant(int id) {
+    if (syncNested()) {
+        return;
+    }
+    Tenant& tenant = *tenants[id];
+    helpUntil([&tenant]() {return tenant.unfinished.load() == 0;});
+}
+
+void TaskSystemFairShare::tenantStats(std::vector<TenantStats>& stats) {
+    stats.clear();
+    std::unique_lock<std::mutex> lock(launchMutex, std::defer_lock);
+    acquire(lock);
+    int count = numTenants.load(std::memory_order_acquire);
+    for (int i = 0; i < count; ++i) {
+        Tenant& tenant = *tenants[i];
+        TenantStats entry;
+        entry.tenant = i;
+        entry.weight = tenant.weight;
+        entry.launches = tenant.launches;
+        entry.busy_seconds = tenant.busyNanos.load(std::memory_order_relaxed) * 1e-9;
+        entry.mean_latency_seconds = tenant.launches == 0 ? 0.0 : tenant.totalLatency / tenant.launches;
+        entry.max_latency_seconds = tenant.maxLatency;
+        stats.push_back(entry);
+    }
+}
+
+TaskSystemFairShare::TenantView::TenantView(TaskSystemFairShare* pool, int id)
+    : ITaskSystem(pool->numThreads), pool(pool), id(id) {}
+
+TaskSystemFairShare::TenantView::~TenantView() {}
+
+const char* TaskSystemFairShare::TenantView::name() {
+    return "Fair Share Tenant";
+}
+
+void TaskSystemFairShare::TenantView::run(IRunnable* runnable, int num_total_tasks) {
+    TenantScope scope(pool, id);
+    pool->run(runnable, num_total_tasks);
+}
+
+TaskID TaskSystemFairShare::TenantView::runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
+                                                         const std::vector<TaskID>& deps) {
+    TenantScope scope(pool, id);
+    return pool->runAsyncWithDeps(runnable, num_total_tasks, deps);
+}
+
+void TaskSystemFairShare::TenantView::runAsyncBatchWithDeps(const std::vector<BulkLaunch>& launches,
+                                                            std::vector<TaskID>& task_ids) {
+    TenantScope scope(pool, id);
+    pool->runAsyncBatchWithDeps(launches, task_ids);
+}
+
+void TaskSystemFairShare::TenantView::runGraphAsync(const TaskGraph& graph,
+                                                    const std::vector<IRunnable*>& runnables,
+                                                    const std::vector<TaskID>& deps,
+                                                    std::vector<TaskID>& task_ids) {
+    TenantScope scope(pool, id);
+    pool->runGraphAsync(graph, runnables, deps, task_ids);
+}
+
+void TaskSystemFairShare::TenantView::sync() {
+    TenantScope scope(pool, id);
+    pool->syncTenant(id);
+}
+
+void TaskSystemFairShare::TenantView::wait(TaskID task_id) {
+    TenantScope scope(pool, id);
+    pool->wait(task_id);
+}
+
+TaskID TaskSystemFairShare::TenantView::waitAny(const std::vector<TaskID>& task_ids) {
+    TenantScope scope(pool, id);
+    return pool->waitAny(task_ids);
+}
+
+ITaskSystem* TaskSystemFairShare::TenantView::tenant(int weight) {
+    return pool->tenant(weight);
+}
+
+void TaskSystemFairShare::TenantView::tenantStats(std::vector<TenantStats>& stats) {
+    pool->tenantStats(stats);
+}
@@ -1,7 +1,19 @@
 #ifndef _TASKSYS_H
 #define _TASKSYS_H
 
+// Let the shared test driver register TaskSystemWorkStealing
+#define TASKSYS_HAS_WORK_STEALING
+// ... and the tests whose tasks launch work into the pool running them
+#define TASKSYS_HAS_NESTED_RUN
+// ... and its -e option for an elastic sleeping pool
+#define TASKSYS_HAS_ELASTIC_POOL
+// ... and TaskSystemFairShare
+#define TASKSYS_HAS_FAIR_SHARE
+
 #include "itasksys.h"
+#include "Placement.h"
+#include "CacheLine.h"
+#include <cstdint>
 #include <atomic>
 #include <mutex>
 #include <condition_variable>  
@@ -9,6 +21,8 @@
 #include <unordered_set>
 #include <unordered_map>
 #include <queue>
+#include <deque>
+#include <memory>
 #include <vector>
 #include <iostream>
 
@@ -53,7 +67,7 @@ class TaskSystemParallelSpawn: public ITaskSystem {
  */
 class TaskSystemParallelThreadPoolSpinning: public ITaskSystem {
     public:
-        TaskSystemParallelThreadPoolSpinning(int num_threads);
+        TaskSystemParallelThreadPoolSpinning(int num_threads, const PlacementPolicy& placement = PlacementPolicy());
         ~TaskSystemParallelThreadPoolSpinning();
         const char* name();
         void run(IRunnable* runnable, int num_total_tasks);
@@ -62,45 +76,212 @@ class TaskSystemParallelThreadPoolSpinning: public ITaskSystem {
         void sync();
 };
 
-// WaitingTask - Represents a task waiting for dependencies to complete
-struct WaitingTask {
-    TaskID id;
-    TaskID dependTaskID{-1};
-    IRunnable* runnable;
-    int numTotalTasks;
+// Launch - one bulk task launch and its place in the dependency graph.
+// Claiming, finishing and the launchMutex-guarded bookkeeping each write
+// their own cache line, away from the read-mostly fields at the top.
+struct Launch {
+    TaskID id{-1};
+    IRunnable* runnable{nullptr};
+    int numTotalTasks{0};
+    alignas(CACHE_LINE_SIZE) std::atomic<int> nextTask{0}; // next task index to hand out
+    alignas(CACHE_LINE_SIZE) std::atomic<int> finishedTasks{0}; // task indices that have finished running, see runNextChunk()
+    std::atomic<double> secondsPerTask{0.0}; // measured cost of one task, drives AdaptiveChunk
+
+    // One reference per ticket sitting in (or taken from) the ready queue,
+    // plus one held until the launch finishes. The record goes back to the
+    // LaunchTable when the last one is dropped, so workers never touch a
+    // recycled record.
+    std::atomic<int> refs{1};
+
+    // The fields below are guarded by launchMutex
+    alignas(CACHE_LINE_SIZE) bool live{false};       // false once the record is back in the LaunchTable
+    int pendingDeps{0};     // launches in deps that have not finished yet
+    std::atomic<bool> done{false}; // also read without the lock by threads that pinned the record in wait()
+
+    // Launches that listed this one in their deps. Each of them gets its
+    // pendingDeps decremented once this launch finishes.
+    std::vector<TaskID> successors;
+
+    // Deps that had not finished when this launch was submitted
+    std::vector<TaskID> deps;
+
+    // Set if the launch is node graphNode of a replayed TaskGraph. The
+    // graph's edges are used in place: its successors inside the graph are
+    // graphBase + the node's successors there, on top of the list above.
+    const TaskGraph* graph{nullptr};
+    int graphNode{0};
+    TaskID graphBase{0};
 
-    WaitingTask(TaskID id, TaskID dependency, IRunnable* runnable, int numTotalTasks)
-    : id(id), dependTaskID(dependency), runnable(runnable), numTotalTasks(numTotalTasks){}
+    // Who submitted the launch, see ITaskSystem::tenant(). 0 unless it came
+    // through a tenant of a TaskSystemFairShare, or from one of its tasks.
+    int tenant{0};
 
-    // Prioritize tasks with smaller depdendent Task ID 
-    //-- used for priority queue to pop up (if returns True, the queue will priorize the second parameter(other)), otherwise the first
-    bool operator<(const WaitingTask& other) const {
-        return dependTaskID > other.dependTaskID;
+    // While a schedule is replayed, which task indices replay has started;
+    // whatever is left once it stops is run as usual, skipping these.
+    // Empty for launches submitted while not replaying.
+    std::vector<char> replayed;
+
+    // Scheduling order among ready launches: weight is the launch's own
+    // length in rounds of numThreads tasks plus the user's hint; priority is
+    // the longest weighted chain from this launch down through its
+    // successors, itself included. Higher priorities are dispatched first.
+    int weight{1};
+    int priority{1};
+
+    // Timeline, only recorded while tracing is on
+    double submitTime{0.0};
+    double readyTime{0.0};
+    std::atomic<double> firstStartTime{0.0};
+
+    // Room for a few edges up front, so typical launches never grow the
+    // vectors; reset() keeps whatever capacity they reached.
+    Launch() {
+        successors.reserve(4);
+        deps.reserve(4);
     }
+
+    // Reinitializes a recycled record for a new launch. The vectors are
+    // cleared but keep their capacity.
+    void reset(TaskID launchID, IRunnable* launchRunnable, int launchTotalTasks);
 };
 
-// ReadyTask - represents a task ready to execute
+// A task of the schedule being recorded, with its place in the schedule
+struct RecordedTask {
+    long long seq;
+    ScheduleEntry entry;
+};
 
-struct ReadyTask {
-    TaskID id;  // Every task has different taskID, taskId starts from 0, all the way to total number rof tasks - 1
-    IRunnable* runnable;
-    int currentTask{0};
-    int numTotalTasks;
+/*
+ * LaunchTable: launch records indexed by TaskID, guarded by launchMutex.
+ * Every slot holds a record from the start; the one for id is in slot
+ * id & mask. Once released it stays in its slot and is reset for the next
+ * TaskID that maps there, so creating a launch allocates nothing and its
+ * successor and dep lists reuse the capacity of earlier launches. Creating a
+ * launch on a slot whose record is still live doubles the table, which is
+ * the only time records are allocated. Records never move, so Launch
+ * pointers stay valid until release().
+ */
+class LaunchTable {
+    std::vector<std::unique_ptr<Launch>> slots;
+    size_t mask;
+
+    void grow();
 
-    ReadyTask() = default;
-    ReadyTask(TaskID id, IRunnable* runnable, int numTotalTasks)
-    : id(id), runnable(runnable), numTotalTasks(numTotalTasks) {}
+    public:
+        explicit LaunchTable(size_t capacity); // capacity must be a power of two
+        Launch& create(TaskID id, IRunnable* runnable, int numTotalTasks);
+        Launch* find(TaskID id); // nullptr once the launch has been released
+        void release(Launch& launch);
+};
 
-    // ReadyTask& operator=(const ReadyTask& other) {
-    //     // std::cout << "copy operator is called\n";
-    //     if (this != &other) {
-    //         id = other.id;
-    //         runnable = other.runnable;
-    //         numTotalTasks = other.numTotalTasks;
-    //         currentTask = other.currentTask;
-    //     }
-    //     return *this;
-    // }
+/*
+ * LaunchQueue: bounded lock-free multi-producer multi-consumer queue of
+ * ready launches (Vyukov's array queue). Pushes that find the ring full go
+ * to a mutex-protected overflow list, which is only touched when a burst of
+ * ready launches exceeds the ring capacity.
+ */
+class LaunchQueue {
+    struct Cell {
+        std::atomic<size_t> sequence;
+        Launch* launch;
+    };
+
+    std::unique_ptr<Cell[]> cells;
+    size_t mask;
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> enqueuePos{0};
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> dequeuePos{0};
+
+    alignas(CACHE_LINE_SIZE) std::deque<Launch*> overflow;
+    std::mutex overflowMutex;
+    std::atomic<int> overflowSize{0};
+
+    bool tryPush(Launch* launch);
+    bool tryPop(Launch*& launch);
+
+    public:
+        explicit LaunchQueue(size_t capacity); // capacity must be a power of two
+        void push(Launch* launch);
+        bool pop(Launch*& launch);
+        bool empty() const;
+        size_t sizeApprox() const; // may be stale by the time it returns
+};
+
+/*
+ * PriorityLaunchQueue: one LaunchQueue per priority level. Levels are
+ * log2-sized buckets of Launch::priority, so launches within a factor of two
+ * share a level and stay FIFO among themselves. pop() takes from the highest
+ * non-empty level, found through a bitmask of levels that may hold work.
+ */
+class PriorityLaunchQueue {
+    static const int numLevels = 16;
+
+    std::vector<std::unique_ptr<LaunchQueue>> levels;
+    alignas(CACHE_LINE_SIZE) std::atomic<unsigned> nonEmpty{0}; // bit i set if levels[i] may hold work
+
+    public:
+        explicit PriorityLaunchQueue(size_t capacityPerLevel);
+        static int levelOf(int priority);
+        void push(Launch* launch, int level);
+        bool pop(Launch*& launch);
+        bool empty() const;
+        size_t sizeApprox() const;
+};
+
+/*
+ * IdlePolicy: how an idle worker waits for new work. It first polls for work
+ * for spinRounds rounds, pausing 1, 2, 4, ... up to maxPausesPerRound times
+ * between polls, and only then parks on a condition variable. spinRounds = 0
+ * parks right away.
+ */
+struct IdlePolicy {
+    int spinRounds;
+    int maxPausesPerRound;
+
+    IdlePolicy(int spin_rounds = 16, int max_pauses_per_round = 64)
+    : spinRounds(spin_rounds), maxPausesPerRound(max_pauses_per_round) {}
+};
+
+/*
+ * ElasticPolicy: lets TaskSystemParallelThreadPoolSleeping run anywhere
+ * between minThreads and num_threads workers, starting with minThreads.
+ * Whenever launches are made ready and the ready queue holds more tickets
+ * than there are workers, workers are started until there are as many as
+ * tickets (up to num_threads). A worker that has been asleep for
+ * idleTimeoutSeconds retires, as long as more than minThreads are left.
+ * Disabled by default: the pool keeps num_threads workers for its whole
+ * lifetime.
+ */
+struct ElasticPolicy {
+    bool enabled;
+    int minThreads;
+    double idleTimeoutSeconds;
+
+    ElasticPolicy(bool enabled = false, int min_threads = 1, double idle_timeout_seconds = 0.05)
+    : enabled(enabled), minThreads(min_threads), idleTimeoutSeconds(idle_timeout_seconds) {}
+};
+
+/*
+ * WorkerCounters: running totals behind one WorkerStats entry, padded to a
+ * cache line of its own. Written with relaxed atomics by the thread they
+ * belong to, so workerStats() can read them while the pool runs.
+ */
+struct alignas(CACHE_LINE_SIZE) WorkerCounters {
+    std::atomic<long long> tasksRun{0};
+    std::atomic<long long> busyNanos{0};
+    std::atomic<long long> idleNanos{0};
+    std::atomic<long long> lockNanos{0};
+    std::atomic<long long> spinWakeups{0};
+    std::atomic<long long> wakeups{0};
+    std::atomic<long long> spuriousWakeups{0};
+    std::atomic<long long> queueDepthSamples{0};
+    std::atomic<long long> queueDepthTotal{0};
+
+    void add(std::atomic<long long>& counter, long long amount) {
+        counter.fetch_add(amount, std::memory_order_relaxed);
+    }
+    void addSeconds(std::atomic<long long>& counter, double seconds) {
+        add(counter, static_cast<long long>(seconds * 1e9));
+    }
 };
 
 /*
@@ -108,42 +289,349 @@ struct ReadyTask {
  * optimized implementation of a parallel task execution engine that uses
  * a thread pool. See definition of ITaskSystem in
  * itasksys.h for documentation of the ITaskSystem interface.
+ *
+ * Tasks may launch and wait on work in the pool that runs them. A thread
+ * blocked in run(), wait() or sync() keeps running ready work, so a worker
+ * waiting on a nested launch helps finish it instead of holding up the pool.
+ * Inside a task, sync() waits only for the launches that task submitted.
  */
 class TaskSystemParallelThreadPoolSleeping: public ITaskSystem {
+    protected:
     
     std::atomic<bool> killed{false}; //notify workerthreads when tasks are done
+    int numThreads;
+    int ticketsPerLaunch; // upper bound on tickets handed out per ready launch
 
-    std::unordered_map<TaskID, std::pair<int, int>> taskProcess; // {TaskID -> finishedCount, totalCount}
-    std::mutex taskProcessMutex;
+    // Every launch that is unfinished or still referenced by a ticket, keyed
+    // by TaskID. A dep that is missing from this table has already finished.
+    LaunchTable launches;
+    alignas(CACHE_LINE_SIZE) std::mutex launchMutex; // guards launches, the dependency fields of Launch and nextTaskID
 
     // TaskID management
-    TaskID finishedTaskID{-1};
     TaskID nextTaskID{0};
-    std::mutex taskIDMutex;
 
-    // Waiting queue for tasks
-    std::priority_queue<WaitingTask> waitingQueue;
-    std::mutex waitingQueueMutex;
+    // Completion is detected without launchMutex: sync() watches
+    // unfinishedLaunches and wait() the done flag of the launch it pinned.
+    // Threads with nothing left to help with park on finishedEpoch, which
+    // wakeLaunchWaiters() bumps whenever a launch finishes or becomes ready
+    // while launchWaiters > 0.
+    alignas(CACHE_LINE_SIZE) std::atomic<int> unfinishedLaunches{0};
+    alignas(CACHE_LINE_SIZE) std::atomic<int> launchWaiters{0};
+    std::atomic<unsigned> finishedEpoch{0};
+
+    // Tickets for launches whose deps have all finished, highest
+    // Launch::priority first. A ready launch gets min(numTotalTasks,
+    // ticketsPerLaunch) tickets; a worker holding one claims AdaptiveChunk-
+    // sized runs of task indices with a fetch_add on Launch::nextTask until
+    // none are left.
+    PriorityLaunchQueue readyQueue;
+    // Task indices of ready launches not claimed from Launch::nextTask yet.
+    // A launch keeps tickets queued after its last index is claimed, so the
+    // ticket count alone overstates the work left.
+    alignas(CACHE_LINE_SIZE) std::atomic<long long> unclaimedTasks{0};
+    std::vector<Launch*> priorityStack; // scratch space for raisePriorities(), guarded by launchMutex
+    std::vector<Launch*> batchRoots;    // scratch space for runAsyncBatchWithDeps(), guarded by launchMutex
+    std::vector<Launch*> graphLaunches; // scratch space for runGraphAsync(), guarded by launchMutex
+
+    // The worker threadPool, one slot per worker. With an ElasticPolicy some
+    // slots are empty: a retiring worker detaches its own thread.
+    alignas(CACHE_LINE_SIZE) std::vector<std::thread> threadPool; 
+    std::vector<CpuInfo> workerCpus; // where worker i is pinned, empty if unpinned
+    std::atomic<int> startedWorkers{0}; // workers that have entered workerMain()
+
+    IdlePolicy idlePolicy;
+
+    // Elastic sizing. workerActive[i] is set while worker i runs; sizeMutex
+    // guards it, the threadPool slots of retiring workers and sizeEvents.
+    ElasticPolicy elastic;
+    std::mutex sizeMutex;
+    std::vector<char> workerActive;
+    std::atomic<int> activeWorkers{0};
+    std::vector<PoolSizeEvent> sizeEvents;
+    std::atomic<int> retiredWorkers{0}; // detached but not yet out of workerMain()
 
-    // Ready queue for tasks ready to run
-    std::queue<ReadyTask> readyQueue; 
-    std::mutex readyQueueMutex;
+    // One entry per worker plus a last one shared by threads outside the
+    // pool that help in run(), sync() and wait()
+    std::vector<WorkerCounters> workerCounters;
 
-    // The worker threadPool 
-    std::vector<std::thread> threadPool; 
+    // Timeline recording, see setTracing(). Tasks are appended to the
+    // buffer of the thread that ran them, indexed like workerCounters; the
+    // last one is shared and guarded by traceMutex. launchTraces is guarded
+    // by launchMutex.
+    std::atomic<bool> tracing{false};
+    std::vector<std::vector<TaskTrace>> taskTraces;
+    std::vector<LaunchTrace> launchTraces;
+    std::mutex traceMutex;
 
+    // Schedule recording, see setScheduleRecording(). Tasks are logged
+    // like taskTraces, each with its place in the schedule taken from
+    // scheduleSeq when it starts; the shared buffer is guarded by
+    // scheduleMutex. Recorded launch ids count from scheduleBase.
+    std::atomic<bool> recording{false};
+    std::atomic<long long> scheduleSeq{0};
+    TaskID scheduleBase{0};
+    std::vector<std::vector<RecordedTask>> scheduleRecords;
+    std::mutex scheduleMutex;
+
+    // Schedule replay, see replaySchedule(). While replaying, threads take
+    // no tickets: each starts replayEntries[replayCursor] once it is its
+    // turn, and the ready queue is only drained once replay stops.
+    // replayBusy counts threads running task code (not waiting in a nested
+    // wait) and replayProgress changes whenever the replay moves on, so a
+    // replay that can never move on again is told apart from a slow one.
+    // Guarded by launchMutex, replaying is also read without it.
+    std::atomic<bool> replaying{false};
+    std::vector<ScheduleEntry> replayEntries;
+    size_t replayCursor{0};
+    TaskID replayBase{0};
+    int replayBusy{0};
+    long long replayProgress{0};
+    long long stalledAt{-1}; // replayProgress when last seen stalled, -1 if it was not
+    std::condition_variable replayTurn;
+
+    // Wakeups are sized to the work: wakeWorkers() wakes one sleeper per
+    // piece of readyWork() and a woken worker passes on whatever is left.
+    // pendingWakeups counts workers notified but not running yet, so they
+    // are not woken twice for the same work.
+    alignas(CACHE_LINE_SIZE) std::mutex sleepMutex;
+    std::atomic<int> sleepingWorkers{0};
+    int pendingWakeups{0}; // guarded by sleepMutex
     std::condition_variable taskAvailable;
-    std::condition_variable finishedCondition;
+
+    // Used by subclasses that need their own state in place before the
+    // workers start; they call startWorkers() at the end of their constructor.
+    TaskSystemParallelThreadPoolSleeping(int num_threads, int tickets_per_launch, const PlacementPolicy& placement,
+                                         const IdlePolicy& idle, const ElasticPolicy& elastic);
+    void startWorkers();
+    void stopWorkers();
+    void startWorker(int workerId);
+    void growPool(int target);
+    bool retireWorker(int workerId);
+    void recordPoolSize(bool grew);
+    void workerMain(int workerId);
+    int localSlot();
+    WorkerCounters& localCounters();
+    void acquire(std::unique_lock<std::mutex>& lock);
+
+    Launch& createLaunch(IRunnable* runnable, int num_total_tasks, int priority_hint = 0);
+    void addDependency(Launch& launch, TaskID dep);
+    void raisePriorities(Launch& launch);
+    void markReady(Launch& launch);
+    void finishLaunch(Launch& launch);
+    void releaseLaunch(Launch& launch);
+    virtual void queueTickets(Launch& launch, int tickets);
+    virtual void launchSubmitted(Launch& launch);
+    virtual void launchCompleted(Launch& launch);
+    virtual bool runReadyLaunch();
+    bool runNextChunk(Launch& launch, int& finished);
+    bool launchFinished(TaskID id);
+    bool launchFinishedLocked(TaskID id);
+    Launch* pinLaunch(TaskID id);
+    template <typename Predicate>
+    void helpUntil(Predicate finished);
+    void wakeLaunchWaiters();
+    void recordNestedLaunch(TaskID id);
+    bool syncNested();
+    int runTasks(Launch& launch, int begin, int end);
+    void runTaskRange(Launch& launch, int begin, int end);
+    void runTracedTasks(Launch& launch, int begin, int end, double startTime);
+    void recordTasks(Launch& launch, int begin, int end);
+    bool runReplayedTask(bool helping);
+    Launch* nextReplayedLaunch();
+    bool replayStalled();
+    void stopReplay();
+    void completeTasks(Launch& launch, int count);
+    void wakeWorkers();
+    void wakeSleepers(int work);
+    bool waitForWork();
+    virtual size_t readyWork();
+    size_t claimable(size_t tickets);
+    virtual bool workAvailable();
+    virtual bool helpAvailable();
 
     public:
-        TaskSystemParallelThreadPoolSleeping(int num_threads);
+        TaskSystemParallelThreadPoolSleeping(int num_threads, const PlacementPolicy& placement = PlacementPolicy(),
+                                             const IdlePolicy& idle = IdlePolicy(),
+                                             const ElasticPolicy& elastic = ElasticPolicy());
         ~TaskSystemParallelThreadPoolSleeping();
-        void workerThread();
+        virtual void workerThread(int workerId);
         const char* name();
         void run(IRunnable* runnable, int num_total_tasks);
         TaskID runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
                                 const std::vector<TaskID>& deps);
+        void runAsyncBatchWithDeps(const std::vector<BulkLaunch>& launches,
+                                   std::vector<TaskID>& task_ids);
+        void runGraphAsync(const TaskGraph& graph, const std::vector<IRunnable*>& runnables,
+                           const std::vector<TaskID>& deps, std::vector<TaskID>& task_ids);
         void sync();
+
+        // Both help run ready tasks on the calling thread while they wait
+        void wait(TaskID task_id);
+        TaskID waitAny(const std::vector<TaskID>& task_ids);
+
+        void workerStats(std::vector<WorkerStats>& stats);
+        void setTracing(bool enabled);
+        void traceEvents(std::vector<LaunchTrace>& launches, std::vector<TaskTrace>& tasks);
+        void poolSizeEvents(std::vector<PoolSizeEvent>& events);
+        void setScheduleRecording(bool enabled);
+        void recordedSchedule(std::vector<ScheduleEntry>& schedule);
+        void replaySchedule(const std::vector<ScheduleEntry>& schedule);
+};
+
+// TaskRange - the half-open span [begin, end) of task indices of one launch
+struct TaskRange {
+    Launch* launch;
+    int begin;
+    int end;
+};
+
+/*
+ * RangeDeque: Chase-Lev work-stealing deque of task ranges. The owning
+ * worker pushes and pops at the bottom; any other worker may steal from the
+ * top. Capacity is fixed, push() returns false when the deque is full.
+ */
+class RangeDeque {
+    // fields are atomic so a thief that loses the race on top never reads
+    // a slot torn by the owner; the loser simply retries elsewhere
+    struct Slot {
+        std::atomic<Launch*> launch;
+        std::atomic<int> begin;
+        std::atomic<int> end;
+    };
+
+    std::unique_ptr<Slot[]> slots;
+    int64_t mask;
+    alignas(CACHE_LINE_SIZE) std::atomic<int64_t> top{0};    // moved by thieves
+    alignas(CACHE_LINE_SIZE) std::atomic<int64_t> bottom{0}; // moved by the owner
+
+    public:
+        explicit RangeDeque(size_t capacity); // capacity must be a power of two
+        bool push(const TaskRange& range);
+        bool pop(TaskRange& range);
+        bool steal(TaskRange& range);
+        bool empty() const;
+};
+
+/*
+ * TaskSystemWorkStealing: thread pool where every worker owns a RangeDeque.
+ * A worker that takes a ready launch claims all of its task indices as one
+ * range and splits it lazily: whenever its own deque is empty it pushes the
+ * upper half of what it has left, so there is always exactly one chunk for an
+ * idle worker to steal. Thieves take the oldest entry, i.e. half of the
+ * victim's remaining range, and keep splitting it the same way. With a
+ * PlacementPolicy, thieves try workers on their own core complex first so
+ * neighbouring index ranges stay behind the same last-level cache. Launch
+ * bookkeeping (deps, sync, sleeping) is shared with the sleeping pool.
+ */
+class TaskSystemWorkStealing: public TaskSystemParallelThreadPoolSleeping {
+    std::vector<std::unique_ptr<RangeDeque>> deques; // one per worker
+
+    // victimOrder[i]: the deques worker i tries when stealing, workers on its
+    // own core complex first. The extra last entry is for threads outside
+    // the pool and covers every deque.
+    std::vector<std::vector<int>> victimOrder;
+
+    void runRange(int workerId, TaskRange range);
+    bool stealRange(int thief, TaskRange& range);
+    bool runWorkerStep(int workerId);
+    bool runReadyLaunch();
+    size_t readyWork();
+    bool workAvailable();
+    bool helpAvailable();
+
+    public:
+        TaskSystemWorkStealing(int num_threads, const PlacementPolicy& placement = PlacementPolicy(),
+                               const IdlePolicy& idle = IdlePolicy());
+        ~TaskSystemWorkStealing();
+        void workerThread(int workerId);
+        const char* name();
+};
+
+/*
+ * TaskSystemFairShare: the sleeping pool shared by several tenants (see
+ * ITaskSystem::tenant()), each with its own ready queue. Every tenant
+ * accumulates a virtual time: the worker time spent on its tasks divided by
+ * its weight. A worker looking for work takes a ticket from the tenant with
+ * ready work that has the least virtual time, and after each chunk of tasks
+ * hands the ticket back if another tenant has fallen behind. A tenant that
+ * just went from idle to ready starts level with the least-served tenant
+ * still waiting, so idling earns it no credit to burst with. A heavy tenant
+ * therefore holds up a light one by at most one chunk per worker.
+ *
+ * Launches submitted to the pool itself, and every launch when there are no
+ * other tenants, go to tenant 0 with weight 1; then it behaves like the
+ * sleeping pool. Launches submitted from inside a task belong to that
+ * task's tenant. sync() on the pool waits for every tenant. A thread that
+ * blocks through a tenant's task system only helps with that tenant's work.
+ */
+class TaskSystemFairShare: public TaskSystemParallelThreadPoolSleeping {
+    // What a tenant's task system forwards to: the pool, tagging launches
+    // with its tenant
+    class TenantView: public ITaskSystem {
+        TaskSystemFairShare* pool;
+        int id;
+
+        public:
+            TenantView(TaskSystemFairShare* pool, int id);
+            ~TenantView();
+            const char* name();
+            void run(IRunnable* runnable, int num_total_tasks);
+            TaskID runAsyncWithDeps(IRunnable* runnable, int num_total_tasks,
+                                    const std::vector<TaskID>& deps);
+            void runAsyncBatchWithDeps(const std::vector<BulkLaunch>& launches,
+                                       std::vector<TaskID>& task_ids);
+            void runGraphAsync(const TaskGraph& graph, const std::vector<IRunnable*>& runnables,
+                               const std::vector<TaskID>& deps, std::vector<TaskID>& task_ids);
+            void sync();
+            void wait(TaskID task_id);
+            TaskID waitAny(const std::vector<TaskID>& task_ids);
+            ITaskSystem* tenant(int weight);
+            void tenantStats(std::vector<TenantStats>& stats);
+    };
+
+    struct Tenant {
+        int weight{1};
+        PriorityLaunchQueue ready{64};
+        alignas(CACHE_LINE_SIZE) std::atomic<double> virtualTime{0.0}; // busy seconds / weight
+        std::atomic<long long> busyNanos{0};
+        alignas(CACHE_LINE_SIZE) std::atomic<int> unfinished{0};
+
+        // Guarded by launchMutex
+        long long launches{0};
+        double totalLatency{0.0};
+        double maxLatency{0.0};
+
+        std::unique_ptr<TenantView> view;
+    };
+
+    // All maxTenants are created up front so workers can scan the first
+    // numTenants without a lock; tenant() only publishes the next one.
+    std::vector<std::unique_ptr<Tenant>> tenants;
+    std::atomic<int> numTenants{1};
+    std::mutex tenantMutex; // serializes tenant()
+
+    double leastActiveTime(const Tenant* except);
+    int helpTenant();
+    Tenant* nextTenant();
+    void charge(Tenant& tenant, double seconds);
+    void syncTenant(int id);
+    void queueTickets(Launch& launch, int tickets);
+    void launchSubmitted(Launch& launch);
+    void launchCompleted(Launch& launch);
+    bool runReadyLaunch();
+    size_t readyWork();
+    bool workAvailable();
+    bool helpAvailable();
+
+    public:
+        TaskSystemFairShare(int num_threads, const PlacementPolicy& placement = PlacementPolicy(),
+                            const IdlePolicy& idle = IdlePolicy(), int max_tenants = 16);
+        ~TaskSystemFairShare();
+        const char* name();
+
+        // nullptr once max_tenants - 1 tenants have been handed out
+        ITaskSystem* tenant(int weight);
+        void tenantStats(std::vector<TenantStats>& stats);
 };
 
 #endif
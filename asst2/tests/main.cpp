@@ -1,7 +1,12 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <getopt.h>
 #include <string>
+#include <vector>
+#include <new>
+#include <algorithm>
+#include <utility>
 #include <assert.h>
 
 #include "tasksys.h"
@@ -10,12 +15,71 @@
 #define DEFAULT_NUM_THREADS 8
 #define DEFAULT_NUM_TIMING_ITERATIONS 3
 
+/*
+ * Count every heap allocation made by any thread, for tests that check
+ * what the task system allocates (see num_allocations in tests.h).
+ */
+std::atomic<long long> num_allocations(0);
+
+void* operator new(size_t size) {
+    num_allocations.fetch_add(1, std::memory_order_relaxed);
+    void* p = malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void* operator new(size_t size, std::align_val_t align) {
+    num_allocations.fetch_add(1, std::memory_order_relaxed);
+    void* p = nullptr;
+    if (posix_memalign(&p, std::max(sizeof(void*), (size_t)align), size ? size : 1) != 0) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+// GCC cannot tell that these pair with the operator new above once inlined
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t, std::align_val_t) noexcept {
+    free(p);
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
 
 void usage(const char* progname, std::string *testnames, int num_tests) {
     printf("Usage: %s [options] testname\n", progname);
     printf("Program Options:\n");
     printf("  -n  --num_threads  <INT>      Number of threads: <INT> (default=%d)\n", DEFAULT_NUM_THREADS);
     printf("  -i  --num_timing_iterations <INT> Number of timing iterations: <INT> (default=%d)\n", DEFAULT_NUM_TIMING_ITERATIONS);
+    printf("  -a  --all_impls               Also time the serial, always-spawn and spinning task systems\n");
+    printf("  -s  --worker_stats            Print per-worker scheduling counters after the last timing iteration\n");
+    printf("  -p  --placement <POLICY>      Pin pool workers: none, compact, scatter or a CPU list like 0,2,4-7 (default=none)\n");
+#ifdef TASKSYS_HAS_ELASTIC_POOL
+    printf("  -e  --elastic <MIN>[:<MS>]    Let the sleeping pool shrink to MIN workers after MS ms idle (default=50) and grow back under load\n");
+#endif
+    printf("  -t  --trace <FILE>            Write a Chrome trace (chrome://tracing, ui.perfetto.dev) of the last timing iteration to <FILE>\n");
+    printf("  -r  --record <FILE>           Write the schedule of the last timing iteration to <FILE>\n");
+    printf("  -R  --replay <FILE>           Run every timing iteration on the schedule recorded in <FILE>\n");
     printf("  -?  --help                    This message\n");
     printf("Valid testnames are:");
     for(int i = 0; i < num_tests; i++) {
@@ -28,10 +92,23 @@ enum TaskSystemType {
     PARALLEL_SPAWN,
     PARALLEL_THREAD_POOL_SPINNING,
     PARALLEL_THREAD_POOL_SLEEPING,
+#ifdef TASKSYS_HAS_WORK_STEALING
+    WORK_STEALING,
+#endif
+#ifdef TASKSYS_HAS_PERSISTENT_SPAWN
+    PARALLEL_SPAWN_PERSISTENT,
+#endif
+#ifdef TASKSYS_HAS_FAIR_SHARE
+    FAIR_SHARE,
+#endif
     N_TASKSYS_IMPLS, // This must be in the last position.
 };
 
-ITaskSystem *selectTaskSystemRefImpl(int num_threads, TaskSystemType type) {
+#ifdef TASKSYS_HAS_ELASTIC_POOL
+ElasticPolicy elasticPolicy;
+#endif
+
+ITaskSystem *selectTaskSystemRefImpl(int num_threads, TaskSystemType type, const PlacementPolicy& placement) {
     assert(type < N_TASKSYS_IMPLS);
 
     if (type == SERIAL) {
@@ -39,82 +116,293 @@ ITaskSystem *selectTaskSystemRefImpl(int num_threads, TaskSystemType type) {
     } else if (type == PARALLEL_SPAWN) {
         return new TaskSystemParallelSpawn(num_threads);
     } else if (type == PARALLEL_THREAD_POOL_SPINNING) {
-        return new TaskSystemParallelThreadPoolSpinning(num_threads);
+        return new TaskSystemParallelThreadPoolSpinning(num_threads, placement);
     } else if (type == PARALLEL_THREAD_POOL_SLEEPING) {
-        return new TaskSystemParallelThreadPoolSleeping(num_threads);
+#ifdef TASKSYS_HAS_ELASTIC_POOL
+        return new TaskSystemParallelThreadPoolSleeping(num_threads, placement, IdlePolicy(), elasticPolicy);
+#else
+        return new TaskSystemParallelThreadPoolSleeping(num_threads, placement);
+#endif
+#ifdef TASKSYS_HAS_WORK_STEALING
+    } else if (type == WORK_STEALING) {
+        return new TaskSystemWorkStealing(num_threads, placement);
+#endif
+#ifdef TASKSYS_HAS_PERSISTENT_SPAWN
+    } else if (type == PARALLEL_SPAWN_PERSISTENT) {
+        return new TaskSystemParallelSpawnPersistent(num_threads);
+#endif
+#ifdef TASKSYS_HAS_FAIR_SHARE
+    } else if (type == FAIR_SHARE) {
+        return new TaskSystemFairShare(num_threads, placement);
+#endif
     } else {
         return NULL;
     }
 }
 
+/*
+ * Prints the counters t->workerStats() reports, one line per thread. Lines
+ * are indented so they are not mistaken for timing results.
+ */
+void printWorkerStats(ITaskSystem* t) {
+    std::vector<WorkerStats> stats;
+    t->workerStats(stats);
+    if (stats.empty()) {
+        return;
+    }
+    printf("    %-8s %10s %10s %10s %10s %8s %8s %8s %10s\n", "worker", "tasks", "busy ms", "idle ms",
+           "lock ms", "spun", "woken", "spurious", "avg queue");
+    for (const WorkerStats& w : stats) {
+        char id[16];
+        if (w.worker_id < 0) {
+            snprintf(id, sizeof(id), "caller");
+        } else {
+            snprintf(id, sizeof(id), "%d", w.worker_id);
+        }
+        printf("    %-8s %10lld %10.3f %10.3f %10.3f %8lld %8lld %8lld %10.2f\n", id, w.tasks_run,
+               w.busy_seconds * 1000, w.idle_seconds * 1000, w.lock_seconds * 1000, w.spin_wakeups,
+               w.wakeups, w.spurious_wakeups, w.mean_queue_depth);
+    }
+
+    std::vector<TenantStats> tenants;
+    t->tenantStats(tenants);
+    if (!tenants.empty()) {
+        printf("    %-8s %8s %10s %10s %14s %14s\n", "tenant", "weight", "launches", "busy ms",
+               "mean latency", "max latency");
+    }
+    for (const TenantStats& s : tenants) {
+        printf("    %-8d %8d %10lld %10.3f %11.3f ms %11.3f ms\n", s.tenant, s.weight, s.launches,
+               s.busy_seconds * 1000, s.mean_latency_seconds * 1000, s.max_latency_seconds * 1000);
+    }
+
+    std::vector<PoolSizeEvent> sizes;
+    t->poolSizeEvents(sizes);
+    for (const PoolSizeEvent& e : sizes) {
+        printf("    %10.3f ms  %-7s to %d workers (%lld queued)\n", (e.time - sizes[0].time) * 1000,
+               e.grew ? "grew" : "shrank", e.num_threads, e.queued);
+    }
+}
+
+/*
+ * Appends t's recorded timeline to events as Chrome trace events. Tasks go
+ * to process pid, one thread per worker; launches go to process pid + 1,
+ * one row per launch, split into waiting on deps, queued and running.
+ */
+void appendChromeTrace(std::vector<std::string>& events, ITaskSystem* t, int pid) {
+    std::vector<LaunchTrace> launches;
+    std::vector<TaskTrace> tasks;
+    t->traceEvents(launches, tasks);
+
+    double origin = 1e30;
+    for (const LaunchTrace& l : launches) {
+        origin = std::min(origin, l.submit_time);
+    }
+    for (const TaskTrace& task : tasks) {
+        origin = std::min(origin, task.start_time);
+    }
+
+    char event[256];
+    auto complete = [&](int p, int tid, const char* name, double start, double end, const std::string& args) {
+        snprintf(event, sizeof(event),
+                 "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{%s}}",
+                 name, p, tid, (start - origin) * 1e6, (end - start) * 1e6, args.c_str());
+        events.push_back(event);
+    };
+    auto metadata = [&](const char* kind, int p, int tid, const std::string& name) {
+        snprintf(event, sizeof(event), "{\"name\":\"%s\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                 kind, p, tid, name.c_str());
+        events.push_back(event);
+    };
+
+    metadata("process_name", pid, 0, std::string(t->name()) + ": workers");
+    metadata("process_name", pid + 1, 0, std::string(t->name()) + ": launches");
+
+    std::vector<bool> named;
+    for (const TaskTrace& task : tasks) {
+        int tid = task.worker_id + 1; // outside threads share tid 0
+        if (tid >= (int)named.size()) {
+            named.resize(tid + 1, false);
+        }
+        if (!named[tid]) {
+            named[tid] = true;
+            metadata("thread_name", pid, tid, tid == 0 ? "caller" : "worker " + std::to_string(task.worker_id));
+        }
+        char name[32], args[64];
+        snprintf(name, sizeof(name), "launch %d", task.launch_id);
+        snprintf(args, sizeof(args), "\"launch\":%d,\"task\":%d", task.launch_id, task.task_id);
+        complete(pid, tid, name, task.start_time, task.end_time, args);
+    }
+
+    for (const LaunchTrace& l : launches) {
+        char args[64];
+        snprintf(args, sizeof(args), "\"num_total_tasks\":%d", l.num_total_tasks);
+        metadata("thread_name", pid + 1, l.launch_id, "launch " + std::to_string(l.launch_id));
+        complete(pid + 1, l.launch_id, "waiting on deps", l.submit_time, l.ready_time, args);
+        complete(pid + 1, l.launch_id, "queued", l.ready_time, l.first_start_time, args);
+        complete(pid + 1, l.launch_id, "running", l.first_start_time, l.last_finish_time, args);
+    }
+}
+
+/*
+ * Schedule files, as written by --record and read by --replay: for each task
+ * system a line "# <name>", then one "<launch_id> <task_id> <worker_id>"
+ * line per task of its schedule, in order.
+ */
+typedef std::vector<std::pair<std::string, std::vector<ScheduleEntry>>> ScheduleFile;
+
+bool writeSchedules(const char* path, const ScheduleFile& schedules) {
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        return false;
+    }
+    for (const auto& schedule : schedules) {
+        fprintf(file, "# %s\n", schedule.first.c_str());
+        for (const ScheduleEntry& entry : schedule.second) {
+            fprintf(file, "%d %d %d\n", entry.launch_id, entry.task_id, entry.worker_id);
+        }
+    }
+    fclose(file);
+    return true;
+}
+
+bool readSchedules(const char* path, ScheduleFile& schedules) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        return false;
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), file)) {
+        ScheduleEntry entry;
+        if (line[0] == '#') {
+            std::string name(line + 1);
+            name.erase(0, name.find_first_not_of(' '));
+            name.erase(name.find_last_not_of("\r\n") + 1);
+            schedules.push_back({name, std::vector<ScheduleEntry>()});
+        } else if (!schedules.empty() &&
+                   sscanf(line, "%d %d %d", &entry.launch_id, &entry.task_id, &entry.worker_id) == 3) {
+            schedules.back().second.push_back(entry);
+        }
+    }
+    fclose(file);
+    return true;
+}
+
 int main(int argc, char** argv)
 {
-    const int n_tests = 31;
     int num_threads = DEFAULT_NUM_THREADS;
     int num_timing_iterations = DEFAULT_NUM_TIMING_ITERATIONS;
+    bool worker_stats = false;
+    int first_impl = PARALLEL_THREAD_POOL_SLEEPING;
+    PlacementPolicy placement;
+    const char* trace_path = NULL;
+    std::vector<std::string> trace_events;
+    const char* record_path = NULL;
+    ScheduleFile recorded_schedules;
+    ScheduleFile replayed_schedules;
 
-    TestResults (*test[n_tests])(ITaskSystem*) = {
+    TestResults (*test[])(ITaskSystem*) = {
         simpleTestSync,
         simpleTestAsync,
         pingPongEqualTest,
         pingPongUnequalTest,
         superLightTest,
         superSuperLightTest,
+        parallelForLightTest,
         recursiveFibonacciTest,
         mathOperationsInTightForLoopTest,
         mathOperationsInTightForLoopFewerTasksTest,
         mathOperationsInTightForLoopFanInTest,
         mathOperationsInTightForLoopReductionTreeTest,
+        mathOperationsInTightForLoopParallelReduceTest,
         spinBetweenRunCallsTest,
         mandelbrotChunkedTest,
         pingPongEqualAsyncTest,
         pingPongUnequalAsyncTest,
         superLightAsyncTest,
         superSuperLightAsyncTest,
+        superSuperLightCoroutineAsyncTest,
         recursiveFibonacciAsyncTest,
         mathOperationsInTightForLoopAsyncTest,
         mathOperationsInTightForLoopFewerTasksAsyncTest,
         mathOperationsInTightForLoopFanInAsyncTest,
         mathOperationsInTightForLoopReductionTreeAsyncTest,
         mandelbrotChunkedAsyncTest,
+        fairShareLightVsHeavyAsyncTest,
         spinBetweenRunCallsAsyncTest,
         simpleRunDepsTest,
         strictDiamondDepsTest,
+        strictWaitDepsTest,
+        steadyStateAllocationTest,
         strictGraphDepsSmall,
         strictGraphDepsMedium,
         strictGraphDepsLarge,
+        strictGraphDepsLargeBatch,
+        strictGraphDepsReplay,
+        strictGraphDepsScheduleReplay,
+#ifdef TASKSYS_HAS_NESTED_RUN
+        nestedFibonacciTest,
+#endif
+#ifdef TASKSYS_HAS_ELASTIC_POOL
+        elasticPoolGrowShrinkTest,
+#endif
     };
+    const int n_tests = sizeof(test) / sizeof(test[0]);
 
-    std::string test_names[n_tests] = {
+    std::string test_names[] = {
         "simple_test_sync",
         "simple_test_async",
         "ping_pong_equal",
         "ping_pong_unequal",
         "super_light",
         "super_super_light",
+        "parallel_for_light",
         "recursive_fibonacci",
         "math_operations_in_tight_for_loop",
         "math_operations_in_tight_for_loop_fewer_tasks",
         "math_operations_in_tight_for_loop_fan_in",
         "math_operations_in_tight_for_loop_reduction_tree",
+        "math_operations_in_tight_for_loop_parallel_reduce",
         "spin_between_run_calls",
         "mandelbrot_chunked",
         "ping_pong_equal_async",
         "ping_pong_unequal_async",
         "super_light_async",
         "super_super_light_async",
+        "super_super_light_coroutine_async",
         "recursive_fibonacci_async",
         "math_operations_in_tight_for_loop_async",
         "math_operations_in_tight_for_loop_fewer_tasks_async",
         "math_operations_in_tight_for_loop_fan_in_async",
         "math_operations_in_tight_for_loop_reduction_tree_async",
         "mandelbrot_chunked_async",
+        "fair_share_light_vs_heavy_async",
         "spin_between_run_calls_async",
         "simple_run_deps_test",
         "strict_diamond_deps_async",
+        "strict_wait_deps_async",
+        "steady_state_allocations_async",
         "strict_graph_deps_small_async",
         "strict_graph_deps_med_async",
         "strict_graph_deps_large_async",
+        "strict_graph_deps_large_batch_async",
+        "strict_graph_deps_replay_async",
+        "strict_graph_deps_schedule_replay_async",
+#ifdef TASKSYS_HAS_NESTED_RUN
+        "nested_fibonacci",
+#endif
+#ifdef TASKSYS_HAS_ELASTIC_POOL
+        "elastic_pool_grow_shrink",
+#endif
+    };
+    static_assert(sizeof(test_names) / sizeof(test_names[0]) == sizeof(test) / sizeof(test[0]),
+                  "every test needs a name");
+
+    // Tests that build the task system they check themselves instead of
+    // using the one passed in. They run once, under that system's name.
+    std::vector<std::pair<std::string, int>> own_system_tests = {
+#ifdef TASKSYS_HAS_ELASTIC_POOL
+        {"elastic_pool_grow_shrink", PARALLEL_THREAD_POOL_SLEEPING},
+#endif
     };
  
     // Parse commandline options
@@ -122,10 +410,17 @@ int main(int argc, char** argv)
     static struct option long_options[] = {
         {"num_threads",           1, 0,  'n'},
         {"num_timing_iterations", 1, 0,  'i'},
+        {"all_impls",             0, 0,  'a'},
+        {"worker_stats",          0, 0,  's'},
+        {"placement",             1, 0,  'p'},
+        {"trace",                 1, 0,  't'},
+        {"record",                1, 0,  'r'},
+        {"replay",                1, 0,  'R'},
+        {"elastic",               1, 0,  'e'},
         {"help",                  0, 0,  '?'},
     };
 
-    while ((opt = getopt_long(argc, argv, "n:i:?", long_options, NULL)) != EOF) {
+    while ((opt = getopt_long(argc, argv, "n:i:asp:t:e:r:R:?", long_options, NULL)) != EOF) {
 
         switch (opt) {
         case 'n':
@@ -134,6 +429,38 @@ int main(int argc, char** argv)
         case 'i':
             num_timing_iterations = atoi(optarg);
             break;
+        case 'a':
+            first_impl = SERIAL;
+            break;
+        case 's':
+            worker_stats = true;
+            break;
+        case 'p':
+            if (!PlacementPolicy::parse(optarg, placement)) {
+                fprintf(stderr, "Error: invalid placement %s!\n", optarg);
+                usage(argv[0], test_names, n_tests);
+                return 1;
+            }
+            break;
+        case 't':
+            trace_path = optarg;
+            break;
+        case 'r':
+            record_path = optarg;
+            break;
+        case 'R':
+            if (!readSchedules(optarg, replayed_schedules)) {
+                fprintf(stderr, "Error: could not open %s for reading!\n", optarg);
+                return 1;
+            }
+            break;
+#ifdef TASKSYS_HAS_ELASTIC_POOL
+        case 'e': {
+            const char* timeout = strchr(optarg, ':');
+            elasticPolicy = ElasticPolicy(true, atoi(optarg), timeout ? atof(timeout + 1) / 1000 : 0.05);
+            break;
+        }
+#endif
         case '?':
         default:
             usage(argv[0], test_names, n_tests);
@@ -162,12 +489,34 @@ int main(int argc, char** argv)
         printf("============================================================="
                "======================\n");
 
-        for (int i = 3; i < N_TASKSYS_IMPLS; i++) {
+        int only_impl = -1;
+        for (const auto& own : own_system_tests) {
+            if (own.first == test_name) {
+                only_impl = own.second;
+            }
+        }
+
+        for (int i = first_impl; i < N_TASKSYS_IMPLS; i++) {
+            if (only_impl >= 0 && i != only_impl) {
+                continue;
+            }
             double minT = 1e30;
             for (int j = 0; j < num_timing_iterations; j++) {
 
                 // Create a new task system
-                ITaskSystem *t = selectTaskSystemRefImpl(num_threads, (TaskSystemType) i);
+                ITaskSystem *t = selectTaskSystemRefImpl(num_threads, (TaskSystemType) i, placement);
+
+                if (trace_path && j+1 == num_timing_iterations) {
+                    t->setTracing(true);
+                }
+                if (record_path && j+1 == num_timing_iterations) {
+                    t->setScheduleRecording(true);
+                }
+                for (const auto& schedule : replayed_schedules) {
+                    if (schedule.first == t->name()) {
+                        t->replaySchedule(schedule.second);
+                    }
+                }
 
                 // Run test
                 TestResults result = test[test_id](t);
@@ -184,6 +533,16 @@ int main(int argc, char** argv)
                 // TODO: do this better
                 if( j+1 == num_timing_iterations) {
                     printf("[%s]:\t\t[%.3f] ms\n", t->name(), minT * 1000);
+                    if (worker_stats) {
+                        printWorkerStats(t);
+                    }
+                    if (trace_path) {
+                        appendChromeTrace(trace_events, t, 2 * i);
+                    }
+                    if (record_path) {
+                        recorded_schedules.push_back({t->name(), std::vector<ScheduleEntry>()});
+                        t->recordedSchedule(recorded_schedules.back().second);
+                    }
                 }
 
                 // Shutdown task system so each timing run is from a clean start
@@ -199,5 +558,24 @@ int main(int argc, char** argv)
         return 1;
     }
 
+    if (trace_path) {
+        FILE* trace = fopen(trace_path, "w");
+        if (!trace) {
+            fprintf(stderr, "Error: could not open %s for writing!\n", trace_path);
+            return 1;
+        }
+        fprintf(trace, "{\"traceEvents\":[\n");
+        for (size_t i = 0; i < trace_events.size(); i++) {
+            fprintf(trace, "%s%s\n", trace_events[i].c_str(), i + 1 < trace_events.size() ? "," : "");
+        }
+        fprintf(trace, "]}\n");
+        fclose(trace);
+    }
+
+    if (record_path && !writeSchedules(record_path, recorded_schedules)) {
+        fprintf(stderr, "Error: could not open %s for writing!\n", record_path);
+        return 1;
+    }
+
     return 0;
 }
@@ -0,0 +1,75 @@
+"""
+Compares runtasks builds that differ only in how the pools' shared state is
+padded (see CACHE_LINE_SIZE and "make padding_bench"). Every build runs the
+test in a fresh process RUNS times, timing all of its task systems (-a), and
+the report gives the median, min and max time per task system. When perf is
+installed each build is also run once under "perf stat" with the given
+events, so the change in coherence misses shows up next to the change in
+time. Pass a HITM event for your CPU with -e to count cross-core line
+transfers directly.
+
+usage: padding_bench.py [-r RUNS] [-t TEST] [-n THREADS] [-e EVENTS] LABEL=BINARY...
+"""
+
+import argparse
+import re
+import shutil
+import statistics
+import subprocess
+
+RESULT_LINE = re.compile(r"^\[(.+)\]:\s+\[([0-9.]+)\] ms")
+
+
+def run_times(binary, test, threads, runs):
+    times = {}
+    for _ in range(runs):
+        out = subprocess.run([binary, "-a", "-n", str(threads), "-i", "1", test],
+                             capture_output=True, text=True, check=True).stdout
+        for line in out.splitlines():
+            match = RESULT_LINE.match(line)
+            if match:
+                times.setdefault(match.group(1), []).append(float(match.group(2)))
+    return times
+
+
+def perf_counts(binary, test, threads, runs, events):
+    # perf stat -x, prints "value,unit,event,..." lines on stderr
+    result = subprocess.run(["perf", "stat", "-x,", "-e", events, binary,
+                             "-a", "-n", str(threads), "-i", str(runs), test],
+                            capture_output=True, text=True)
+    counts = {}
+    for line in result.stderr.splitlines():
+        fields = line.split(",")
+        if len(fields) > 2 and fields[2]:
+            counts[fields[2]] = fields[0]
+    return counts
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("-r", "--runs", type=int, default=11)
+    parser.add_argument("-t", "--test", default="super_super_light")
+    parser.add_argument("-n", "--threads", type=int, default=8)
+    parser.add_argument("-e", "--events", default="cache-misses,cache-references")
+    parser.add_argument("builds", nargs="+", metavar="LABEL=BINARY")
+    args = parser.parse_args()
+
+    builds = [build.split("=", 1) for build in args.builds]
+    print("%s, %d threads, %d runs per build" % (args.test, args.threads, args.runs))
+    print("%-10s %-36s %10s %10s %10s" % ("build", "task system", "median ms", "min ms", "max ms"))
+    for label, binary in builds:
+        for name, times in run_times(binary, args.test, args.threads, args.runs).items():
+            print("%-10s %-36s %10.3f %10.3f %10.3f" % (label, name, statistics.median(times),
+                                                       min(times), max(times)))
+
+    if not shutil.which("perf"):
+        print("perf not found, skipping the %s counts" % args.events)
+        return
+    print("%-10s %-36s %10s" % ("build", "event", "count"))
+    for label, binary in builds:
+        for event, count in perf_counts(binary, args.test, args.threads, args.runs, args.events).items():
+            print("%-10s %-36s %10s" % (label, event, count))
+
+
+if __name__ == "__main__":
+    main()
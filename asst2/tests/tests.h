@@ -9,6 +9,10 @@
 
 #include "CycleTimer.h"
 #include "itasksys.h"
+#include "ParallelFor.h"
+#include "ParallelReduce.h"
+#include "TaskGraph.h"
+#include "Coroutine.h"
 
 /*
 Sync tests
@@ -37,8 +41,25 @@ TestResults mathOperationsInTightForLoopReductionTreeAsyncTest(ITaskSystem* t);
 TestResults spinBetweenRunCallsAsyncTest(ITaskSystem *t);
 TestResults mandelbrotChunkedAsyncTest(ITaskSystem* t);
 TestResults simpleRunDepsTest(ITaskSystem *t);
+TestResults strictWaitDepsTest(ITaskSystem *t);
+TestResults steadyStateAllocationTest(ITaskSystem *t);
+TestResults strictGraphDepsLargeBatch(ITaskSystem* t);
+TestResults strictGraphDepsReplay(ITaskSystem* t);
+TestResults strictGraphDepsScheduleReplay(ITaskSystem* t);
+TestResults nestedFibonacciTest(ITaskSystem* t);
+TestResults parallelForLightTest(ITaskSystem* t);
+TestResults mathOperationsInTightForLoopParallelReduceTest(ITaskSystem* t);
+TestResults fairShareLightVsHeavyAsyncTest(ITaskSystem* t);
+TestResults superSuperLightCoroutineAsyncTest(ITaskSystem* t);
+TestResults elasticPoolGrowShrinkTest(ITaskSystem* t);
 */
 
+/*
+ * Number of heap allocations made so far by any thread, counted by the
+ * operator new in main.cpp
+ */
+extern std::atomic<long long> num_allocations;
+
 /*
  * Structure to hold results of performance tests
  */
@@ -227,6 +248,47 @@ class RecursiveFibonacciTask: public IRunnable {
         }
 };
 
+/*
+ * Task i computes Fibonacci number indices_[i] like RecursiveFibonacciTask,
+ * but above cutoff_ it launches the two subproblems as a bulk launch on the
+ * task system running it. Odd indices wait with run(), even ones with
+ * runAsyncWithDeps() and sync().
+ */
+class NestedFibonacciTask: public IRunnable {
+    public:
+        ITaskSystem* t_;
+        const int* indices_;
+        int cutoff_;
+        int *output_;
+        NestedFibonacciTask(ITaskSystem* t, const int* indices, int cutoff, int *output)
+            : t_(t), indices_(indices), cutoff_(cutoff), output_(output) {}
+        ~NestedFibonacciTask() {}
+
+        int slowFn(int n) {
+            if (n < 2) return 1;
+            return slowFn(n-1) + slowFn(n-2);
+        }
+
+        void runTask(int task_id, int num_total_tasks) {
+            int n = indices_[task_id];
+            if (n < cutoff_) {
+                output_[task_id] = slowFn(n);
+                return;
+            }
+            int sub_indices[2] = {n - 1, n - 2};
+            int sub_output[2];
+            NestedFibonacciTask sub(t_, sub_indices, cutoff_, sub_output);
+            if (n % 2) {
+                t_->run(&sub, 2);
+            } else {
+                std::vector<TaskID> no_deps;
+                t_->runAsyncWithDeps(&sub, 2, no_deps);
+                t_->sync();
+            }
+            output_[task_id] = sub_output[0] + sub_output[1];
+        }
+};
+
 /*
  * Each task copies its task id into the output.
  */
@@ -567,6 +629,23 @@ TestResults simpleTestAsync(ITaskSystem* t) {
     return simpleTest(t, true);
 }
 
+/*
+ * The chain of launches of pingPongTest() driven by a coroutine: each launch
+ * is co_awaited before the next is submitted, from whichever thread resumed
+ * the coroutine. Every 50 launches a LightTask launch is also submitted
+ * without waiting, and the next ping-pong launch lists it in its deps.
+ */
+LaunchCoroutine pingPongCoroutine(ITaskSystem* t, const std::vector<PingPongTask*>& runnables, int num_tasks,
+                                  LightTask* side_task, int num_side_tasks) {
+    for (size_t i = 0; i < runnables.size(); i++) {
+        std::vector<TaskID> deps;
+        if (i % 50 == 0) {
+            deps.push_back(t->runAsyncWithDeps(side_task, num_side_tasks, std::vector<TaskID>()));
+        }
+        co_await launch(*t, runnables[i], num_tasks, deps);
+    }
+}
+
 /*
  * Computation: pingPongTest launches 400 bulk task launches with 64 tasks each.
  * The computation done by each bulk task launch takes as input a buffer of size
@@ -582,13 +661,16 @@ TestResults simpleTestAsync(ITaskSystem* t) {
  * launching threads is non-trival and so there are benefits to a thread pool.
  * The amount of computation per task is controlled using `num_elements` and
  * `base_iters`, because each task gets `num_elements` / `num_tasks` elements
- * and does O(base_iters) work per element.
+ * and does O(base_iters) work per element. With `use_coroutine` the async
+ * chain is submitted by pingPongCoroutine() instead, which also adds the
+ * side launches of a LightTask.
  */
 TestResults pingPongTest(ITaskSystem* t, bool equal_work, bool do_async,
-                         int num_elements, int base_iters) {
+                         int num_elements, int base_iters, bool use_coroutine = false) {
 
     int num_tasks = 64;
     int num_bulk_task_launches = 400;   
+    int num_side_tasks = 16;
 
     int* input = new int[num_elements];
     int* output = new int[num_elements];
@@ -613,29 +695,41 @@ TestResults pingPongTest(ITaskSystem* t, bool equal_work, bool do_async,
                 num_elements, output, input,
                 equal_work, base_iters);
     }
+    std::vector<int> side_output(num_side_tasks, -1);
+    LightTask side_task(side_output.data());
 
     // Run the test
     double start_time = CycleTimer::currentSeconds();
     TaskID prev_task_id;
-    for (int i=0; i<num_bulk_task_launches; i++) {
-        if (do_async) {
-            std::vector<TaskID> deps;
-            if (i > 0) {
-                deps.push_back(prev_task_id);
+    bool finished = true;
+    if (use_coroutine) {
+        LaunchCoroutine pipeline = pingPongCoroutine(t, runnables, num_tasks, &side_task, num_side_tasks);
+        t->sync();
+        finished = pipeline.done();
+    } else {
+        for (int i=0; i<num_bulk_task_launches; i++) {
+            if (do_async) {
+                std::vector<TaskID> deps;
+                if (i > 0) {
+                    deps.push_back(prev_task_id);
+                }
+                prev_task_id = t->runAsyncWithDeps(
+                    runnables[i], num_tasks, deps);
+            } else {
+                t->run(runnables[i], num_tasks);
             }
-            prev_task_id = t->runAsyncWithDeps(
-                runnables[i], num_tasks, deps);
-        } else {
-            t->run(runnables[i], num_tasks);
         }
+        if (do_async)
+            t->sync();
     }
-    if (do_async)
-        t->sync();
     double end_time = CycleTimer::currentSeconds();
 
     // Correctness validation
     TestResults results;
-    results.passed = true;
+    results.passed = finished;
+    for (int i=0; i<num_side_tasks && use_coroutine; i++) {
+        results.passed = results.passed && side_output[i] == i;
+    }
 
     // Number of ping-pongs determines which buffer to look at for the results
     int* buffer = (num_bulk_task_launches % 2 == 1) ? output : input; 
@@ -677,6 +771,79 @@ TestResults superSuperLightAsyncTest(ITaskSystem* t) {
     return pingPongTest(t, true, true, num_elements, base_iters);
 }
 
+TestResults superSuperLightCoroutineAsyncTest(ITaskSystem* t) {
+    int num_elements = 32 * 1024;
+    int base_iters = 0;
+    return pingPongTest(t, true, true, num_elements, base_iters, true);
+}
+
+/*
+ * The super_super_light ping-pong and the SimpleMultiplyTask body written as
+ * lambdas through parallel_for() and parallel_for_range(), where the body is
+ * inlined into each block instead of called through runTask() per index.
+ * Also covers empty, single-block and uneven index spaces.
+ */
+TestResults parallelForLightTest(ITaskSystem* t) {
+    int num_elements = 32 * 1024;
+    int num_bulk_task_launches = 400;
+
+    int* input = new int[num_elements];
+    int* output = new int[num_elements];
+    for (int i = 0; i < num_elements; i++) {
+        input[i] = i;
+        output[i] = 0;
+    }
+
+    double start_time = CycleTimer::currentSeconds();
+    for (int i = 0; i < num_bulk_task_launches; i++) {
+        int* src = (i % 2 == 0) ? input : output;
+        int* dst = (i % 2 == 0) ? output : input;
+        parallel_for(*t, num_elements, [=](int j) {
+            dst[j] = src[j] + 1;
+        });
+    }
+    parallel_for_range(*t, num_elements, [=](int begin, int end) {
+        for (int j = begin; j < end; j++) {
+            input[j] = SimpleMultiplyTask::multiply_task(3, input[j]);
+        }
+    });
+    double end_time = CycleTimer::currentSeconds();
+
+    TestResults result;
+    result.passed = true;
+    for (int i = 0; i < num_elements; i++) {
+        int expected = SimpleMultiplyTask::multiply_task(3, i + num_bulk_task_launches);
+        if (input[i] != expected) {
+            printf("%d: %d expected=%d\n", i, input[i], expected);
+            result.passed = false;
+            break;
+        }
+    }
+
+    // every index exactly once, whatever the block size
+    int sizes[] = {0, 1, 7, 1000};
+    int grains[] = {0, 1, 3, 1000, 4096};
+    for (int n : sizes) {
+        for (int grain : grains) {
+            std::vector<std::atomic<int>> hits(n);
+            parallel_for(*t, n, [&](int j) {
+                hits[j]++;
+            }, grain);
+            for (int j = 0; j < n; j++) {
+                if (hits[j] != 1) {
+                    printf("n=%d grain=%d: index %d ran %d times\n", n, grain, j, hits[j].load());
+                    result.passed = false;
+                }
+            }
+        }
+    }
+    result.time = end_time - start_time;
+
+    delete [] input;
+    delete [] output;
+    return result;
+}
+
 TestResults superLightTest(ITaskSystem* t) {
     int num_elements = 32 * 1024;
     int base_iters = 32;
@@ -765,7 +932,6 @@ TestResults recursiveFibonacciTestBase(ITaskSystem* t, bool do_async) {
     for (int i = 0; i < num_bulk_task_launches; i++) {
         delete fib_tasks[i];
     }
-    std::cout << "finish the testbase function\n";
     return result;
 }
 
@@ -777,6 +943,109 @@ TestResults recursiveFibonacciAsyncTest(ITaskSystem* t) {
     return recursiveFibonacciTestBase(t, true);
 }
 
+/*
+ * The recursive Fibonacci computation again, with every task splitting its
+ * work into nested launches on the same task system. More tasks than
+ * threads sit in nested launches at once, so a pool that blocks a waiting
+ * worker instead of letting it run other work deadlocks here.
+ */
+TestResults nestedFibonacciTest(ITaskSystem* t) {
+    int num_tasks = 64;
+    int fib_index = 25;
+    int cutoff = 15;
+
+    std::vector<int> indices(num_tasks, fib_index);
+    int* task_output = new int[num_tasks]();
+    NestedFibonacciTask task(t, indices.data(), cutoff, task_output);
+
+    double start_time = CycleTimer::currentSeconds();
+    t->run(&task, num_tasks);
+    double end_time = CycleTimer::currentSeconds();
+
+    TestResults result;
+    result.passed = true;
+    for (int i = 0; i < num_tasks; i++) {
+        if (task_output[i] != 121393) {
+            result.passed = false;
+            break;
+        }
+    }
+    result.time = end_time - start_time;
+
+    delete [] task_output;
+    return result;
+}
+
+#ifdef TASKSYS_HAS_ELASTIC_POOL
+/*
+ * Each task sleeps for sleep_ms milliseconds and then records its id, so
+ * a launch of them keeps the ready queue backed up for a while.
+ */
+class NapTask: public IRunnable {
+    public:
+        int sleep_ms_;
+        int* output_;
+        NapTask(int sleep_ms, int* output) : sleep_ms_(sleep_ms), output_(output) {}
+        ~NapTask() {}
+
+        void runTask(int task_id, int num_total_tasks) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(sleep_ms_));
+            output_[task_id] = task_id;
+        }
+};
+
+/*
+ * Ignores t and builds its own TaskSystemParallelThreadPoolSleeping with
+ * an ElasticPolicy, which starts with a single worker. A launch of slow
+ * tasks must make the pool grow, and once it has been idle for longer
+ * than the timeout it must shrink back to that one worker. Both changes
+ * are checked in poolSizeEvents(). main.cpp runs it once, in the sleeping
+ * pool's row.
+ */
+TestResults elasticPoolGrowShrinkTest(ITaskSystem* t) {
+    int num_threads = 4;
+    int num_tasks = 32;
+    double idle_timeout = 0.02;
+    int* output = new int[num_tasks];
+    for (int i = 0; i < num_tasks; i++) {
+        output[i] = -1;
+    }
+    NapTask task(1, output);
+
+    double start_time = CycleTimer::currentSeconds();
+    TaskSystemParallelThreadPoolSleeping pool(num_threads, PlacementPolicy(), IdlePolicy(),
+                                              ElasticPolicy(true, 1, idle_timeout));
+    std::vector<TaskID> no_deps;
+    pool.runAsyncWithDeps(&task, num_tasks, no_deps);
+    pool.sync();
+
+    // every worker but one should retire a timeout after going idle
+    std::vector<PoolSizeEvent> events;
+    double deadline = CycleTimer::currentSeconds() + 100 * idle_timeout;
+    do {
+        std::this_thread::sleep_for(std::chrono::duration<double>(idle_timeout));
+        pool.poolSizeEvents(events);
+    } while ((events.empty() || events.back().num_threads > 1) && CycleTimer::currentSeconds() < deadline);
+    double end_time = CycleTimer::currentSeconds();
+
+    bool grew = false;
+    for (const PoolSizeEvent& e : events) {
+        grew = grew || (e.grew && e.num_threads > 1);
+    }
+    bool shrank = grew && !events.back().grew && events.back().num_threads == 1;
+
+    TestResults result;
+    result.passed = grew && shrank;
+    for (int i = 0; i < num_tasks; i++) {
+        result.passed = result.passed && output[i] == i;
+    }
+    result.time = end_time - start_time;
+
+    delete [] output;
+    return result;
+}
+#endif
+
 /*
  * Computation: The following tests perform exps, logs, and multiplications
  * in a tight for loop. Tasks are sufficiently compute-intensive and lightweight:
@@ -1097,6 +1366,80 @@ TestResults mathOperationsInTightForLoopReductionTreeAsyncTest(ITaskSystem* t) {
     return mathOperationsInTightForLoopReductionTreeTestBase(t, true);
 }
 
+/*
+ * The reduction tree test with the hand-built tree of ReduceTask launches
+ * replaced by one parallel_reduce() over the outputs, one block per output.
+ * parallel_reduce() combines in the same pairwise order, so the sums match
+ * the reduction tree test exactly. Also checks a scalar sum over blocks of
+ * uneven size.
+ */
+TestResults mathOperationsInTightForLoopParallelReduceTest(ITaskSystem* t) {
+    int num_tasks = 64;
+    int num_bulk_task_launches = 32;
+    int array_size = 16384;
+    float* buffer = new float[num_bulk_task_launches*array_size];
+
+    std::vector<MathOperationsInTightForLoopTask> medium_tasks;
+    for (int i = 0; i < num_bulk_task_launches; i++) {
+        medium_tasks.push_back(MathOperationsInTightForLoopTask(
+            array_size, &buffer[i*array_size]));
+    }
+
+    double start_time = CycleTimer::currentSeconds();
+    for (int i = 0; i < num_bulk_task_launches; i++) {
+        t->run(&medium_tasks[i], num_tasks);
+    }
+    std::vector<float> sums = parallel_reduce(*t, num_bulk_task_launches, std::vector<float>(array_size, 0.0f),
+        [&](int begin, int end, std::vector<float>& acc) {
+            for (int i = begin; i < end; i++) {
+                for (int j = 0; j < array_size; j++) {
+                    acc[j] += buffer[i*array_size + j];
+                }
+            }
+        },
+        [&](std::vector<float>& into, const std::vector<float>& from) {
+            for (int j = 0; j < array_size; j++) {
+                into[j] += from[j];
+            }
+        }, 1);
+    double end_time = CycleTimer::currentSeconds();
+
+    TestResults result;
+    result.passed = true;
+    for (int i = 0; i < array_size; i++) {
+        int expected = (i % 3 == 0) ? 11197 : (i % 3 == 1) ? 22687 : 67950 * num_bulk_task_launches;
+        if (std::floor(sums[i]) != expected) {
+            printf("%d: %f expected=%d\n", i, std::floor(sums[i]), expected);
+            result.passed = false;
+            break;
+        }
+    }
+
+    int sizes[] = {0, 1, 1000, 100003};
+    int grains[] = {0, 1, 7, 4096};
+    for (int n : sizes) {
+        for (int grain : grains) {
+            long long sum = parallel_reduce(*t, n, 0LL,
+                [](int begin, int end, long long& acc) {
+                    for (int i = begin; i < end; i++) {
+                        acc += i;
+                    }
+                },
+                [](long long& into, const long long& from) {
+                    into += from;
+                }, grain);
+            if (sum != (long long)n * (n - 1) / 2) {
+                printf("n=%d grain=%d: sum %lld expected=%lld\n", n, grain, sum, (long long)n * (n - 1) / 2);
+                result.passed = false;
+            }
+        }
+    }
+    result.time = end_time - start_time;
+
+    delete [] buffer;
+    return result;
+}
+
 /*
  * Computation: In between two calls to a light weight task, these tests spawn
  * a medium weight bulk task launch that only has enough enough tasks to
@@ -1241,6 +1584,106 @@ TestResults mandelbrotChunkedAsyncTest(ITaskSystem* t) {
     return mandelbrotChunkedTestBase(t, true);
 }
 
+/*
+ * Two tenants of t (see ITaskSystem::tenant()) at once: a heavy one queues
+ * a fixed set of mandelbrot_chunked_async launches from a second thread
+ * while a light one submits a series of small launches, syncing after
+ * each. Every task system gets the same work. The light series is first
+ * timed on the idle pool, and the reported time is the light tenant's
+ * under contention. With tenants it has to finish before the heavy
+ * launches do; without them its sync() waits for the heavy launches, and
+ * it may only take as long as they do plus its idle time.
+ */
+TestResults fairShareLightVsHeavyAsyncTest(ITaskSystem* t) {
+    int num_tasks = 16;
+    int num_bulk_task_launches = 200;
+    int num_heavy_launches = 4;
+
+    ITaskSystem* heavy = t->tenant(1);
+    ITaskSystem* light = t->tenant(1);
+    if (!heavy || !light) {
+        heavy = light = t;
+    }
+
+    MandelbrotTask::MandelArgs ma;
+    ma.x0 = -2;
+    ma.x1 = 1;
+    ma.y0 = -1;
+    ma.y1 = 1;
+    ma.width = 1600;
+    ma.height = 1200;
+    ma.max_iterations = 256;
+    ma.output = new int[ma.width * ma.height];
+    MandelbrotTask mandel_task(&ma, true);
+
+    int* output = new int[num_tasks];
+    LightTask light_task(output);
+    std::vector<TaskID> no_deps;
+    bool light_passed = true;
+    auto run_light = [&]() {
+        double start_time = CycleTimer::currentSeconds();
+        for (int i = 0; i < num_bulk_task_launches; i++) {
+            for (int j = 0; j < num_tasks; j++) {
+                output[j] = -1;
+            }
+            light->runAsyncWithDeps(&light_task, num_tasks, no_deps);
+            light->sync();
+            for (int j = 0; j < num_tasks; j++) {
+                light_passed = light_passed && output[j] == j;
+            }
+        }
+        return CycleTimer::currentSeconds() - start_time;
+    };
+    double idle_time = run_light();
+
+    std::atomic<bool> heavy_started(false);
+    double heavy_start_time = 0;
+    double heavy_end_time = 0;
+    std::thread heavy_thread([&]() {
+        heavy_start_time = CycleTimer::currentSeconds();
+        for (int i = 0; i < num_heavy_launches; i++) {
+            heavy->runAsyncWithDeps(&mandel_task, 128, no_deps);
+        }
+        heavy_started = true;
+        heavy->sync();
+        heavy_end_time = CycleTimer::currentSeconds();
+    });
+    while (!heavy_started) {
+        std::this_thread::yield();
+    }
+    double light_start_time = CycleTimer::currentSeconds();
+    double light_time = run_light();
+    double light_end_time = light_start_time + light_time;
+    heavy_thread.join();
+    delete [] output;
+
+    bool fair = true;
+    if (heavy != t) {
+        fair = light_end_time < heavy_end_time;
+    } else {
+        fair = light_time <= heavy_end_time - heavy_start_time + 4 * idle_time + 0.01;
+    }
+    if (!fair) {
+        printf("fair_share_light_vs_heavy: light %.3f ms (%.3f ms idle), heavy %.3f ms\n",
+               light_time * 1000, idle_time * 1000, (heavy_end_time - heavy_start_time) * 1000);
+    }
+
+    int *golden = new int[ma.width * ma.height];
+    mandel_task.mandelbrotSerial(ma.x0, ma.y0, ma.x1, ma.y1, ma.width, ma.height,
+                                 0, ma.height, ma.max_iterations, golden);
+    bool heavy_passed = true;
+    for (int i = 0; i < ma.width * ma.height; i++) {
+        heavy_passed = heavy_passed && golden[i] == ma.output[i];
+    }
+    delete [] golden;
+    delete [] ma.output;
+
+    TestResults result;
+    result.passed = light_passed && heavy_passed && fair;
+    result.time = light_time;
+    return result;
+}
+
 /*
  * Computation: Simple correctness test for runAsyncWithDeps.
  * Tasks sleep for a prescribed amount of time and then print
@@ -1334,11 +1777,127 @@ TestResults strictDiamondDepsTest(ITaskSystem *t) {
     return result;
 };
 
+/*
+ * This test makes sure wait() and waitAny() only return once the launches
+ * they were given, and everything those depend on, are done: a chain
+ * a -> b -> c next to an independent launch d.
+ */
+TestResults strictWaitDepsTest(ITaskSystem *t) {
+    bool *done = new bool[4]();
+
+    std::vector<bool*> a_dep_fs;
+    IRunnable* a = new StrictDependencyTask(a_dep_fs, done);
+
+    std::vector<bool*> b_dep_fs = {done};
+    IRunnable* b = new StrictDependencyTask(b_dep_fs, done+1);
+
+    std::vector<bool*> c_dep_fs = {done+1};
+    IRunnable* c = new StrictDependencyTask(c_dep_fs, done+2);
+
+    std::vector<bool*> d_dep_fs;
+    IRunnable* d = new StrictDependencyTask(d_dep_fs, done+3);
+
+    std::vector<TaskID> no_deps;
+
+    double start_time = CycleTimer::currentSeconds();
+    auto a_task_id = t->runAsyncWithDeps(a, 4, no_deps);
+    auto b_task_id = t->runAsyncWithDeps(b, 16, {a_task_id});
+    auto c_task_id = t->runAsyncWithDeps(c, 64, {b_task_id});
+    auto d_task_id = t->runAsyncWithDeps(d, 64, no_deps);
+
+    TestResults result;
+    t->wait(b_task_id);
+    result.passed = done[0] && done[1];
+
+    TaskID first = t->waitAny({c_task_id, d_task_id});
+    result.passed = result.passed && done[first == c_task_id ? 2 : 3];
+
+    t->sync();
+    double end_time = CycleTimer::currentSeconds();
+
+    result.passed = result.passed && done[2] && done[3];
+    result.time = end_time - start_time;
+
+    delete[] done;
+    delete a;
+    delete b;
+    delete c;
+    delete d;
+
+    return result;
+}
+
+/*
+ * Computation: Adds 1 to every element of an array, one element per task.
+ * Independent launches may update the same element concurrently.
+ */
+class IncrementTask: public IRunnable {
+    public:
+        std::atomic<int>* array_;
+        IncrementTask(std::atomic<int>* array) : array_(array) {}
+        ~IncrementTask() {}
+
+        void runTask(int task_id, int num_total_tasks) {
+            array_[task_id]++;
+        }
+};
+
+/*
+ * This test checks that, once warmed up, submitting and finishing launches
+ * does not allocate. It runs the same mix of run() calls and chains of
+ * dependent async launches twice and counts the heap allocations made by
+ * every thread during the second round, which must be zero.
+ */
+TestResults steadyStateAllocationTest(ITaskSystem *t) {
+    const int num_chains = 4;
+    const int chain_length = 32;
+    const int num_tasks = 16;
+    const int rounds = 2;
+
+    std::atomic<int>* array = new std::atomic<int>[num_tasks]();
+    IncrementTask task(array);
+    std::vector<TaskID> deps(1); // reused, so building deps does not allocate
+    std::vector<TaskID> no_deps;
+    long long allocations = 0;
+
+    double start_time = CycleTimer::currentSeconds();
+    for (int round = 0; round < rounds; round++) {
+        long long before = num_allocations.load();
+        for (int i = 0; i < num_chains; i++) {
+            t->run(&task, num_tasks);
+            TaskID prev_task_id = t->runAsyncWithDeps(&task, num_tasks, no_deps);
+            for (int j = 1; j < chain_length; j++) {
+                deps[0] = prev_task_id;
+                prev_task_id = t->runAsyncWithDeps(&task, num_tasks, deps);
+            }
+        }
+        t->sync();
+        allocations = num_allocations.load() - before;
+    }
+    double end_time = CycleTimer::currentSeconds();
+
+    TestResults result;
+    result.passed = allocations == 0;
+    for (int i = 0; i < num_tasks; i++) {
+        if (array[i] != rounds * num_chains * (chain_length + 1)) {
+            result.passed = false;
+        }
+    }
+    if (allocations != 0) {
+        printf("steady_state_allocations: %lld allocations in the second round\n", allocations);
+    }
+    result.time = end_time - start_time;
+
+    delete[] array;
+    return result;
+}
+
 /*
  * These tests generates and run a random DAG of n tasks and at most m edges,
- * and make all dependencies are satisfied.
+ * and make all dependencies are satisfied. With do_batch the whole graph is
+ * submitted through a single runAsyncBatchWithDeps() call.
  */
-TestResults strictGraphDepsTestBase(ITaskSystem*t, int n, int m, unsigned int seed) {
+TestResults strictGraphDepsTestBase(ITaskSystem*t, int n, int m, unsigned int seed, bool do_batch) {
     // For repeatability.
     srand(seed);
 
@@ -1376,13 +1935,24 @@ TestResults strictGraphDepsTestBase(ITaskSystem*t, int n, int m, unsigned int se
     }
 
     double start_time = CycleTimer::currentSeconds();
-    for (int i = 0; i < n; i++) {
-        // Populate TaskID deps.
-        for (int idx : idx_deps[i]) {
-            task_deps[i].push_back(task_ids[idx]);
+    if (do_batch) {
+        std::vector<BulkLaunch> batch(n);
+        for (int i = 0; i < n; i++) {
+            batch[i].runnable = tasks[i];
+            batch[i].num_total_tasks = (rand() % 15) + 1;
+            batch[i].batch_deps = idx_deps[i];
+        }
+        std::vector<TaskID> batch_ids;
+        t->runAsyncBatchWithDeps(batch, batch_ids);
+    } else {
+        for (int i = 0; i < n; i++) {
+            // Populate TaskID deps.
+            for (int idx : idx_deps[i]) {
+                task_deps[i].push_back(task_ids[idx]);
+            }
+            // Launch async and record this task's id.
+            task_ids[i] = t->runAsyncWithDeps(tasks[i], (rand() % 15) + 1, task_deps[i]);
         }
-        // Launch async and record this task's id.
-        task_ids[i] = t->runAsyncWithDeps(tasks[i], (rand() % 15) + 1, task_deps[i]);
     }
     t->sync();
     double end_time = CycleTimer::currentSeconds();
@@ -1394,13 +1964,140 @@ TestResults strictGraphDepsTestBase(ITaskSystem*t, int n, int m, unsigned int se
 }
 
 TestResults strictGraphDepsSmall(ITaskSystem* t) {
-    return strictGraphDepsTestBase(t,4,2,0);
+    return strictGraphDepsTestBase(t,4,2,0,false);
 }
 
 TestResults strictGraphDepsMedium(ITaskSystem* t) {
-    return strictGraphDepsTestBase(t,100,1000,0);
+    return strictGraphDepsTestBase(t,100,1000,0,false);
 }
 
 TestResults strictGraphDepsLarge(ITaskSystem* t) {
-    return strictGraphDepsTestBase(t,1000,20000,0);
+    return strictGraphDepsTestBase(t,1000,20000,0,false);
+}
+
+TestResults strictGraphDepsLargeBatch(ITaskSystem* t) {
+    return strictGraphDepsTestBase(t,1000,20000,0,true);
+}
+
+/*
+ * Runs strict_graph_deps_med_async while recording its schedule, then runs
+ * it again replaying that schedule and recording once more. Both runs must
+ * be correct, and the second must have started every task on the same
+ * thread and in the same order as the first. Task systems that do not
+ * record schedules just run it twice.
+ */
+TestResults strictGraphDepsScheduleReplay(ITaskSystem* t) {
+    std::vector<ScheduleEntry> recorded;
+    std::vector<ScheduleEntry> replayed;
+
+    t->setScheduleRecording(true);
+    TestResults first = strictGraphDepsMedium(t);
+    t->recordedSchedule(recorded);
+
+    t->replaySchedule(recorded);
+    t->setScheduleRecording(true);
+    TestResults second = strictGraphDepsMedium(t);
+    t->recordedSchedule(replayed);
+    t->setScheduleRecording(false);
+
+    size_t matching = 0;
+    while (matching < recorded.size() && matching < replayed.size() &&
+           recorded[matching].launch_id == replayed[matching].launch_id &&
+           recorded[matching].task_id == replayed[matching].task_id &&
+           recorded[matching].worker_id == replayed[matching].worker_id) {
+        matching++;
+    }
+    bool same = matching == recorded.size() && matching == replayed.size();
+    if (!same) {
+        printf("schedule replay: first %zu of %zu tasks followed the recorded schedule (%zu recorded)\n",
+               matching, replayed.size(), recorded.size());
+    }
+
+    TestResults result;
+    result.passed = first.passed && second.passed && same;
+    result.time = second.time;
+    return result;
+}
+
+/*
+ * Records a random DAG once with a TaskGraphRecorder, then replays it for a
+ * number of frames with fresh StrictDependencyTasks, each frame's roots
+ * depending on the previous frame's last node. Every launch of every frame
+ * must see its deps done.
+ */
+TestResults strictGraphDepsReplay(ITaskSystem* t) {
+    int n = 100;
+    int m = 1000;
+    int num_frames = 20;
+    srand(0);
+
+    std::vector<int> idx_deps[n];
+    std::set<std::pair<int,int> > eset;
+    for (int i = 0; i < m; i++) {
+        int s = rand() % n;
+        int t = rand() % n;
+        if (s > t) {
+            std::swap(s,t);
+        }
+        if (s == t || eset.count({s,t})) {
+            continue;
+        }
+        idx_deps[t].push_back(s);
+        eset.insert({s,t});
+    }
+
+    TaskGraphRecorder recorder;
+    for (int i = 0; i < n; i++) {
+        std::vector<TaskID> deps(idx_deps[i].begin(), idx_deps[i].end());
+        recorder.runAsyncWithDeps(nullptr, (rand() % 15) + 1, deps);
+    }
+    TaskGraph graph = recorder.graph();
+
+    // done[f*n + i]: node i of frame f has run with its deps met
+    bool* done = new bool[num_frames * n]();
+    std::vector<std::vector<bool*>> flag_deps(num_frames * n);
+    std::vector<IRunnable*> tasks(num_frames * n);
+    for (int f = 0; f < num_frames; f++) {
+        for (int i = 0; i < n; i++) {
+            std::vector<bool*>& flags = flag_deps[f*n + i];
+            for (int idx : idx_deps[i]) {
+                flags.push_back(done + f*n + idx);
+            }
+            if (f > 0 && idx_deps[i].empty()) {
+                flags.push_back(done + (f-1)*n + n-1);
+            }
+            tasks[f*n + i] = new StrictDependencyTask(flags, done + f*n + i);
+        }
+    }
+
+    double start_time = CycleTimer::currentSeconds();
+    std::vector<IRunnable*> runnables(n);
+    std::vector<TaskID> deps;
+    std::vector<TaskID> task_ids;
+    for (int f = 0; f < num_frames; f++) {
+        for (int i = 0; i < n; i++) {
+            runnables[i] = tasks[f*n + i];
+        }
+        t->runGraphAsync(graph, runnables, deps, task_ids);
+        deps.assign(1, task_ids[n-1]);
+    }
+    t->sync();
+    double end_time = CycleTimer::currentSeconds();
+
+    TestResults result;
+    result.passed = true;
+    for (int i = 0; i < num_frames * n; i++) {
+        if (!done[i]) {
+            printf("frame %d node %d: deps not met\n", i / n, i % n);
+            result.passed = false;
+            break;
+        }
+    }
+    result.time = end_time - start_time;
+
+    for (IRunnable* task : tasks) {
+        delete task;
+    }
+    delete[] done;
+    return result;
 }